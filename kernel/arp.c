@@ -0,0 +1,401 @@
+//
+// ARP: the neighbor cache mapping on-link IP addresses to
+// Ethernet addresses.
+//
+// datagrams for a neighbor whose address isn't known yet are
+// held on its entry while an ARP request is outstanding, and
+// sent when the reply comes in. once known, an address is a
+// hash lookup away. arp_tick() retries requests, gives up on
+// neighbors that don't answer, and re-checks entries that
+// haven't been heard from in a while.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "net.h"
+
+// everything else goes through qemu's gateway.
+static uint32 netmask = MAKE_IP_ADDR(255, 255, 255, 0);
+static uint32 gateway_ip = MAKE_IP_ADDR(10, 0, 2, 2);
+
+#define NARP       64   // neighbor cache entries
+#define NARPHASH   64   // hash buckets, a power of two
+#define ARP_QLEN   4    // datagrams held per unresolved neighbor
+#define ARP_TTL    600  // ticks before a cached address is re-checked
+#define ARP_RETRY  10   // ticks between requests
+#define ARP_TRIES  3    // requests before giving up
+
+enum { ARP_FREE, ARP_PENDING, ARP_RESOLVED };
+
+struct arpent {
+  int state;
+  uint32 ip;              // host byte order
+  uint8 mac[ETHADDR_LEN];
+  uint updated;           // ticks when last heard from
+  uint requested;         // ticks when last asked for
+  int tries;              // requests since last heard from
+  char *q[ARP_QLEN];      // frames waiting for mac
+  int qlen[ARP_QLEN];
+  int qflags[ARP_QLEN];   // e1000_transmit() flags
+  int nq;
+  struct arpent *next;    // hash chain
+};
+
+// arplock protects all of it.
+static struct spinlock arplock;
+static struct arpent arptab[NARP];
+static struct arpent *arphash[NARPHASH];
+
+void
+arpinit(void)
+{
+  initlock(&arplock, "arp");
+}
+
+static inline struct arpent **
+arp_bucket(uint32 ip)
+{
+  return &arphash[(ip ^ (ip >> 16)) & (NARPHASH - 1)];
+}
+
+// caller must hold arplock.
+static struct arpent *
+arp_find(uint32 ip)
+{
+  struct arpent *e;
+
+  for(e = *arp_bucket(ip); e; e = e->next)
+    if(e->ip == ip)
+      return e;
+  return 0;
+}
+
+// caller must hold arplock.
+static void
+arp_unlink(struct arpent *e)
+{
+  struct arpent **pp;
+
+  for(pp = arp_bucket(e->ip); *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  e->state = ARP_FREE;
+}
+
+// make an entry for ip, evicting the resolved entry that has
+// gone longest without being heard from if the table is full.
+// returns 0 if every entry is waiting for a reply.
+// caller must hold arplock.
+static struct arpent *
+arp_alloc(uint32 ip)
+{
+  struct arpent *e, *victim = 0;
+
+  for(e = arptab; e < arptab + NARP; e++){
+    if(e->state == ARP_FREE){
+      victim = e;
+      break;
+    }
+    if(e->state == ARP_RESOLVED &&
+       (victim == 0 || ticks - e->updated > ticks - victim->updated))
+      victim = e;
+  }
+  if(victim == 0)
+    return 0;
+  if(victim->state != ARP_FREE)
+    arp_unlink(victim);
+
+  memset(victim, 0, sizeof(*victim));
+  victim->ip = ip;
+  victim->state = ARP_PENDING;
+  victim->updated = ticks;
+  struct arpent **b = arp_bucket(ip);
+  victim->next = *b;
+  *b = victim;
+  return victim;
+}
+
+static void
+arp_send(int op, uint8 *dmac, uint32 tip)
+{
+  char *buf = pbuf_alloc();
+  if(buf == 0)
+    return;
+
+  struct eth *eth = (struct eth *) buf;
+  if(dmac)
+    memmove(eth->dhost, dmac, ETHADDR_LEN);
+  else
+    memset(eth->dhost, 0xff, ETHADDR_LEN); // broadcast
+  memmove(eth->shost, local_mac, ETHADDR_LEN);
+  eth->type = htons(ETHTYPE_ARP);
+
+  struct arp *arp = (struct arp *)(eth + 1);
+  arp->hrd = htons(ARP_HRD_ETHER);
+  arp->pro = htons(ETHTYPE_IP);
+  arp->hln = ETHADDR_LEN;
+  arp->pln = sizeof(uint32);
+  arp->op = htons(op);
+
+  memmove(arp->sha, local_mac, ETHADDR_LEN);
+  arp->sip = htonl(local_ip);
+  if(dmac)
+    memmove(arp->tha, dmac, ETHADDR_LEN);
+  else
+    memset(arp->tha, 0, ETHADDR_LEN);
+  arp->tip = htonl(tip);
+
+  // may be called from the receive path or the clock
+  // interrupt, so don't wait for room.
+  if(e1000_transmit(buf, sizeof(*eth) + sizeof(*arp), 0) < 0)
+    pbuf_free(buf);
+}
+
+// the neighbor to send a datagram for dst to.
+static uint32
+arp_nexthop(uint32 dst)
+{
+  if((dst & netmask) == (local_ip & netmask))
+    return dst;
+  return gateway_ip;
+}
+
+// if the Ethernet address for sending to dst is known,
+// copy it to mac and return 1; otherwise return 0.
+int
+arp_lookup(uint32 dst, uint8 *mac)
+{
+  uint32 ip = arp_nexthop(dst);
+  int r = 0;
+
+  acquire(&arplock);
+  struct arpent *e = arp_find(ip);
+  if(e && e->state == ARP_RESOLVED){
+    memmove(mac, e->mac, ETHADDR_LEN);
+    r = 1;
+  }
+  release(&arplock);
+  return r;
+}
+
+// fill in the destination Ethernet address of buf, a frame of
+// len bytes carrying an IP datagram for dst.
+// returns 1 if done, and the caller should send buf;
+// 0 if buf now belongs to ARP, which will send it with
+// e1000_transmit(..., flags) once the address is known (or
+// drop it, like any datagram, if it never is);
+// or -1 if the cache is full, and the caller should free buf.
+int
+arp_fill(char *buf, int len, uint32 dst, int flags)
+{
+  struct eth *eth = (struct eth *) buf;
+  uint32 ip = arp_nexthop(dst);
+  int ask = 0;
+
+  acquire(&arplock);
+  struct arpent *e = arp_find(ip);
+  if(e && e->state == ARP_RESOLVED){
+    memmove(eth->dhost, e->mac, ETHADDR_LEN);
+    release(&arplock);
+    return 1;
+  }
+
+  if(e == 0){
+    if((e = arp_alloc(ip)) == 0){
+      release(&arplock);
+      return -1;
+    }
+    e->requested = ticks;
+    e->tries = 1;
+    ask = 1;
+  }
+
+  // if the queue is full, drop the oldest datagram, which
+  // has been waiting longest.
+  char *drop = 0;
+  if(e->nq == ARP_QLEN){
+    drop = e->q[0];
+    e->nq--;
+    memmove(e->q, e->q + 1, e->nq * sizeof(e->q[0]));
+    memmove(e->qlen, e->qlen + 1, e->nq * sizeof(e->qlen[0]));
+    memmove(e->qflags, e->qflags + 1, e->nq * sizeof(e->qflags[0]));
+  }
+  e->q[e->nq] = buf;
+  e->qlen[e->nq] = len;
+  e->qflags[e->nq] = flags & ~E1000_TX_WAIT;
+  e->nq++;
+  release(&arplock);
+
+  if(drop){
+    NETSTAT_INC(arp_unres);
+    pbuf_free(drop);
+  }
+  if(ask)
+    arp_send(ARP_OP_REQUEST, 0, ip);
+  return 0;
+}
+
+// wait until the Ethernet address for sending to dst is known,
+// asking for it if need be, and copy it to mac. for senders
+// with more frames than ARP holds for a neighbor.
+// returns 0, or -1 if the neighbor doesn't answer, the cache
+// is full, or the caller is killed.
+int
+arp_resolve(uint32 dst, uint8 *mac)
+{
+  uint32 ip = arp_nexthop(dst);
+  int asked = 0;
+
+  acquire(&arplock);
+  for(;;){
+    struct arpent *e = arp_find(ip);
+    if(e && e->state == ARP_RESOLVED){
+      memmove(mac, e->mac, ETHADDR_LEN);
+      release(&arplock);
+      return 0;
+    }
+    if(killed(myproc()))
+      break;
+    if(e == 0){
+      // gone since we asked means arp_tick() gave up.
+      if(asked || (e = arp_alloc(ip)) == 0)
+        break;
+      e->requested = ticks;
+      e->tries = 1;
+      asked = 1;
+      release(&arplock);
+      arp_send(ARP_OP_REQUEST, 0, ip);
+      acquire(&arplock);
+      continue;
+    }
+    asked = 1;
+    sleep(e, &arplock);
+  }
+  release(&arplock);
+  return -1;
+}
+
+// note that ip is at mac, and send anything that was
+// waiting for it. with create, add an entry if need be.
+static void
+arp_update(uint32 ip, uint8 *mac, int create)
+{
+  char *q[ARP_QLEN];
+  int qlen[ARP_QLEN], qflags[ARP_QLEN];
+  int nq = 0;
+
+  acquire(&arplock);
+  struct arpent *e = arp_find(ip);
+  if(e == 0 && create)
+    e = arp_alloc(ip);
+  if(e){
+    memmove(e->mac, mac, ETHADDR_LEN);
+    e->state = ARP_RESOLVED;
+    e->updated = ticks;
+    e->tries = 0;
+    nq = e->nq;
+    for(int i = 0; i < nq; i++){
+      q[i] = e->q[i];
+      qlen[i] = e->qlen[i];
+      qflags[i] = e->qflags[i];
+      memmove(((struct eth *)q[i])->dhost, mac, ETHADDR_LEN);
+    }
+    e->nq = 0;
+    wakeup(e);
+  }
+  release(&arplock);
+
+  for(int i = 0; i < nq; i++)
+    if(e1000_transmit(q[i], qlen[i], qflags[i]) < 0)
+      pbuf_free(q[i]);
+}
+
+//
+// handle a received ARP packet: learn the sender's address
+// (adding an entry only if it's asking for us, as RFC 826
+// says), and answer requests for our address.
+//
+void
+arp_rx(char *inbuf)
+{
+  struct eth *ineth = (struct eth *) inbuf;
+  struct arp *inarp = (struct arp *) (ineth + 1);
+
+  // don't delete this printf; make grade depends on it.
+  static int seen_arp = 0;
+  if(seen_arp == 0)
+    printf("arp_rx: received an ARP packet\n");
+  seen_arp = 1;
+
+  NETSTAT_INC(arp_rx);
+  if(ntohs(inarp->hrd) != ARP_HRD_ETHER || ntohs(inarp->pro) != ETHTYPE_IP ||
+     inarp->hln != ETHADDR_LEN || inarp->pln != sizeof(uint32)){
+    NETSTAT_INC(rx_short);
+    pbuf_free(inbuf);
+    return;
+  }
+
+  uint32 sip = ntohl(inarp->sip);
+  uint32 tip = ntohl(inarp->tip);
+  uint8 sha[ETHADDR_LEN];
+  memmove(sha, inarp->sha, ETHADDR_LEN);
+  int op = ntohs(inarp->op);
+  pbuf_free(inbuf);
+
+  if(sip != 0)
+    arp_update(sip, sha, tip == local_ip);
+
+  if(op == ARP_OP_REQUEST && tip == local_ip)
+    arp_send(ARP_OP_REPLY, sha, sip);
+}
+
+//
+// called by the clock interrupt on cpu 0 every tick.
+// every ARP_RETRY ticks, re-send requests that haven't been
+// answered, giving up (and dropping what was waiting) after
+// ARP_TRIES; and ask again about neighbors not heard from for
+// ARP_TTL ticks, forgetting them if they still don't answer.
+//
+void
+arp_tick(void)
+{
+  uint32 ask[NARP];
+  int nask = 0;
+
+  if(ticks % ARP_RETRY != 0)
+    return;
+
+  acquire(&arplock);
+  for(struct arpent *e = arptab; e < arptab + NARP; e++){
+    if(e->state == ARP_FREE)
+      continue;
+    if(e->state == ARP_RESOLVED && ticks - e->updated < ARP_TTL)
+      continue;
+    if(ticks - e->requested < ARP_RETRY)
+      continue;
+    if(e->tries >= ARP_TRIES){
+      for(int i = 0; i < e->nq; i++)
+        pbuf_free(e->q[i]);
+      NETSTAT_ADD(arp_unres, e->nq);
+      e->nq = 0;
+      arp_unlink(e);
+      wakeup(e);
+      continue;
+    }
+    e->tries++;
+    e->requested = ticks;
+    ask[nask++] = e->ip;
+  }
+  release(&arplock);
+
+  for(int i = 0; i < nask; i++)
+    arp_send(ARP_OP_REQUEST, 0, ask[i]);
+}
@@ -0,0 +1,211 @@
+//
+// packet capture: a tap on net_rx() and on the e1000's transmit
+// functions that copies each frame, or its first snaplen bytes,
+// into the capture ring, which the capture device drains.
+//
+// the ring is lock-free, so that the tap doesn't serialize the
+// CPUs sending and receiving. each slot has a sequence number
+// saying whether it's free for the producer at a given position
+// or holds a record for the consumer: a producer claims a
+// position with a compare-and-swap on head, fills in the slot,
+// and publishes it by advancing the slot's sequence number. if
+// the ring is full, the frame isn't captured, and is counted in
+// netstats.cap_drops. readers take turns under caplock.
+//
+// when capture is off, the tap costs its callers a load and a
+// branch on capture_on. the ring is allocated the first time
+// capture is turned on, and is then kept, since a tap may still
+// be filling a slot just after capture is turned off.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "net.h"
+
+#define NCAPSLOT    128          // frames the ring holds
+#define CAPSLOTSIZE (PGSIZE / 2)
+
+struct capslot {
+  uint64 seq;         // pos when free for position pos, pos+1 once filled
+  struct caprec rec;  // followed directly by the data
+  char data[CAPSLOTSIZE - sizeof(uint64) - sizeof(struct caprec)];
+};
+
+int capture_on;
+static int snaplen;   // 0 for as much as fits
+static int capport;   // 0 for every frame
+static struct capslot *ring[NCAPSLOT];
+static uint64 head;   // next position to fill
+static uint64 tail;   // next position to read; protected by caplock
+
+// caplock serializes readers, and turning capture on and off.
+static struct spinlock caplock;
+
+// whether a frame, with at least its headers in the hdrlen
+// bytes at hdr, is a UDP datagram to or from port. fragments
+// other than the first don't say, so they don't match.
+static int
+capture_match(char *hdr, int hdrlen, int port)
+{
+  struct eth *eth = (struct eth *)hdr;
+  struct ip *ip = (struct ip *)(eth + 1);
+
+  if(hdrlen < sizeof(*eth) + sizeof(*ip) + sizeof(struct udp) ||
+     ntohs(eth->type) != ETHTYPE_IP || ip->ip_p != IPPROTO_UDP ||
+     (ntohs(ip->ip_off) & IP_OFFMASK) != 0)
+    return 0;
+  struct udp *udp = (struct udp *)((char *)ip + (ip->ip_vhl & 0xf) * 4);
+  if((char *)(udp + 1) > hdr + hdrlen)
+    return 0;
+  return ntohs(udp->sport) == port || ntohs(udp->dport) == port;
+}
+
+//
+// capture a frame: the hdrlen bytes at hdr, followed by nseg
+// segments at physical addresses segs[i], seglens[i] bytes each
+// (as for e1000_transmit_sg()). dir is CAP_RX or CAP_TX.
+// callers check capture_on first.
+//
+void
+capture_tap(int dir, char *hdr, int hdrlen, uint64 *segs, int *seglens, int nseg)
+{
+  struct capslot *s;
+  uint64 pos;
+  int len, n;
+
+  if(capport && !capture_match(hdr, hdrlen, capport))
+    return;
+
+  // claim a slot.
+  pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+  for(;;){
+    s = ring[pos % NCAPSLOT];
+    uint64 seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if(seq == pos){
+      // on failure, pos is set to the current head.
+      if(__atomic_compare_exchange_n(&head, &pos, pos + 1, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if((long)(seq - pos) < 0){
+      // not read yet since the last time round.
+      NETSTAT_INC(cap_drops);
+      return;
+    } else {
+      pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+  }
+
+  len = hdrlen;
+  for(int i = 0; i < nseg; i++)
+    len += seglens[i];
+  n = len;
+  if(snaplen && n > snaplen)
+    n = snaplen;
+  if(n > sizeof(s->data))
+    n = sizeof(s->data);
+
+  s->rec.ns = timer_ns(r_time());
+  s->rec.caplen = n;
+  s->rec.len = len;
+  s->rec.dir = dir;
+
+  int m = hdrlen < n ? hdrlen : n;
+  memmove(s->data, hdr, m);
+  for(int i = 0; i < nseg && m < n; i++){
+    int k = seglens[i] < n - m ? seglens[i] : n - m;
+    memmove(s->data + m, (char *)segs[i], k);
+    m += k;
+  }
+
+  // publish it.
+  __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+// allocate the ring. returns 0, or -1 if out of memory.
+// caller must hold caplock.
+static int
+capture_alloc(void)
+{
+  for(int i = 0; i < NCAPSLOT; i += 2){
+    char *page = kalloc();
+    if(page == 0){
+      for(int j = 0; j < i; j += 2)
+        kfree((char *)ring[j]);
+      memset(ring, 0, sizeof(ring));
+      return -1;
+    }
+    ring[i] = (struct capslot *)page;
+    ring[i + 1] = (struct capslot *)(page + CAPSLOTSIZE);
+  }
+  for(int i = 0; i < NCAPSLOT; i++)
+    ring[i]->seq = i;
+  return 0;
+}
+
+// take as many whole records off the ring as fit in n bytes.
+static int
+captureread(int user_dst, uint64 dst, int n)
+{
+  int done = 0;
+
+  acquire(&caplock);
+  while(ring[0]){
+    struct capslot *s = ring[tail % NCAPSLOT];
+    if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1)
+      break;  // empty
+    int m = sizeof(s->rec) + s->rec.caplen;
+    if(done + m > n)
+      break;
+    if(either_copyout(user_dst, dst + done, &s->rec, m) < 0){
+      if(done == 0)
+        done = -1;
+      break;
+    }
+    done += m;
+    // free for the producer one time round from now.
+    __atomic_store_n(&s->seq, tail + NCAPSLOT, __ATOMIC_RELEASE);
+    tail++;
+  }
+  release(&caplock);
+  return done;
+}
+
+// start or stop capturing, as a struct capctl says.
+static int
+capturewrite(int user_src, uint64 src, int n)
+{
+  struct capctl c;
+
+  if(n != sizeof(c) || either_copyin(&c, user_src, src, n) < 0)
+    return -1;
+  if(c.snaplen < 0 || c.port < 0 || c.port > 65535)
+    return -1;
+
+  acquire(&caplock);
+  if(c.on && ring[0] == 0 && capture_alloc() < 0){
+    release(&caplock);
+    return -1;
+  }
+  snaplen = c.snaplen;
+  capport = c.port;
+  __sync_synchronize();
+  capture_on = c.on != 0;
+  release(&caplock);
+  return n;
+}
+
+void
+captureinit(void)
+{
+  initlock(&caplock, "capture");
+  devsw[CAPTURE].read = captureread;
+  devsw[CAPTURE].write = capturewrite;
+}
@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +51,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct pollhead ph;  // poll()ers waiting for input
 } cons;
 
 //
@@ -174,6 +177,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwake(&cons.ph, POLLIN);
       }
     }
     break;
@@ -182,6 +186,22 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// poll() the console: input is ready once consoleread()
+// wouldn't wait, i.e. a whole line has arrived.
+int
+consolepoll(struct pollentry *e)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  if(e)
+    pollregister(&cons.ph, &cons.lock, e);
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -193,4 +213,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -7,7 +7,13 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct epoll;
+struct netstat_port;
+struct pollentry;
+struct pollhead;
+struct pollwait;
 struct proc;
+struct sock;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -40,6 +46,14 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepoll(struct file*, struct pollentry*);
+
+// epoll.c
+void            epollinit(void);
+int             epollalloc(struct file**);
+void            epollclose(struct epoll*);
+int             epollctl(struct epoll*, int, int, struct file*, int);
+int             epollwait(struct epoll*, uint64, int, int);
 
 // fs.c
 void            fsinit(int);
@@ -78,6 +92,18 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipepoll(struct pipe*, int, struct pollentry*);
+
+// poll.c
+void            pollwaitinit(struct pollwait*);
+void            pollregister(struct pollhead*, struct spinlock*, struct pollentry*);
+void            pollunregister(struct pollentry*);
+void            pollwake(struct pollhead*, int);
+void            pollsleep(struct pollwait*, uint64);
+struct pollentry* polltake(struct pollwait*);
+struct pollentry* pollnext(struct pollentry*);
+void            pollready(struct pollentry*);
+void            pollunready(struct pollentry*);
 
 // printf.c
 int             printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -102,8 +128,10 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+int             kthread_create(void (*)(void), char*);
 int             kwait(uint64);
 void            wakeup(void*);
+void            wakeproc(struct proc*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -159,6 +187,14 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            prepare_return(void);
 
+// timer.c
+void            timerlistinit(void);
+uint64          timer_deadline(int);
+uint64          timer_uclock(void);
+uint64          timer_ns(uint64);
+uint64          timer_run(uint64);
+int             timedsleep(void*, struct spinlock*, uint64);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -234,10 +270,56 @@ void            pci_init();
 // e1000.c
 void            e1000_init(uint32 *);
 void            e1000_intr(void);
-int             e1000_transmit(char *, int);
+void            e1000_tick(void);
+void            e1000_stats(void);
+void            e1000_startpoll(void);
+int             e1000_moderation(void);
+int             e1000_transmit(char *, int, int);
+int             e1000_transmitv(char **, int *, int, int);
+int             e1000_transmit_sg(char *, int, uint64 *, int *, int, int);
+
+// pbuf.c
+void            pbufinit(void);
+char*           pbuf_alloc(void);
+void            pbuf_free(char *);
+
+// arp.c
+void            arpinit(void);
+void            arp_rx(char *);
+void            arp_tick(void);
+int             arp_lookup(uint32, uint8 *);
+int             arp_fill(char *, int, uint32, int);
+int             arp_resolve(uint32, uint8 *);
+
+// ipfrag.c
+void            ipfraginit(void);
+char*           ip_reass(char *, int, int *);
+void            ipfrag_free(char *);
+void            ipfrag_tick(void);
+
+// capture.c
+extern int      capture_on;
+void            captureinit(void);
+void            capture_tap(int, char *, int, uint64 *, int *, int);
+
+// netstat.c
+extern struct netstat netstats;
+#define NETSTAT_INC(f)    __atomic_fetch_add(&netstats.f, 1, __ATOMIC_RELAXED)
+#define NETSTAT_ADD(f, n) __atomic_fetch_add(&netstats.f, (n), __ATOMIC_RELAXED)
+void            netstatinit(void);
+void            rxlat_add(int, uint64, uint64);
 
 // net.c
+extern uint8    local_mac[];
+extern uint32   local_ip;
 void            netinit(void);
-void            net_rx(char *buf, int len);
+void            net_rx(char *buf, int len, int csum, uint64 stamp);
+int             sockalloc(struct file**, uint16, uint32, uint16);
+void            sockclose(struct sock*);
+int             sockread(struct sock*, uint64, int);
+int             sockwrite(struct sock*, uint64, int);
+int             sockpoll(struct sock*, struct pollentry*);
+int             sockopt(struct sock*, int, int);
+int             net_portstats(struct netstat_port*, int);
 
 #endif
@@ -6,19 +6,92 @@
 #include "proc.h"
 #include "defs.h"
 #include "e1000_dev.h"
+#include "net.h"
 
-#define TX_RING_SIZE 16  // Increased from 16 for better throughput
-static struct tx_desc tx_ring[TX_RING_SIZE] __attribute__((aligned(16)));
+// Descriptor ring sizes, chosen at build time with
+// make E1000_TXRING=n E1000_RXRING=n, which writes them to
+// e1000cfg.h. They must be powers of two, so ring indices can
+// wrap with a mask, and at most 4096; a ring of 4096
+// descriptors is 64 KB, and occupies whole pages.
+#include "e1000cfg.h"
 
-#define RX_RING_SIZE 16  // Increased from 16 for better throughput
-static struct rx_desc rx_ring[RX_RING_SIZE] __attribute__((aligned(16)));
+#define TX_RING_SIZE E1000_TX_RING_SIZE
+#define RX_RING_SIZE E1000_RX_RING_SIZE
+
+#if TX_RING_SIZE < 8 || TX_RING_SIZE > 4096 || (TX_RING_SIZE & (TX_RING_SIZE - 1)) != 0
+#error "E1000_TX_RING_SIZE must be a power of two between 8 and 4096"
+#endif
+#if RX_RING_SIZE < 8 || RX_RING_SIZE > 4096 || (RX_RING_SIZE & (RX_RING_SIZE - 1)) != 0
+#error "E1000_RX_RING_SIZE must be a power of two between 8 and 4096"
+#endif
+
+#define TX_RING_NEXT(i) (((i) + 1) & (TX_RING_SIZE - 1))
+#define RX_RING_NEXT(i) (((i) + 1) & (RX_RING_SIZE - 1))
+
+// the kernel's memory is mapped one-to-one, so page-aligned
+// static rings are physically contiguous, as the e1000 needs.
+static struct tx_desc tx_ring[TX_RING_SIZE] __attribute__((aligned(PGSIZE)));
+static struct rx_desc rx_ring[RX_RING_SIZE] __attribute__((aligned(PGSIZE)));
 
 // remember where the e1000's registers live.
 static volatile uint32 *regs;
 
+// Transmit ring state, protected by e1000_transmit_lock.
+// descriptors tx_clean .. tx_tail-1 are owned by the e1000
+// until e1000_txreclaim() sees that they have been sent.
+static uint32 tx_tail;      // software copy of TDT, so transmit needn't read it back over MMIO
+static uint32 tx_clean;     // oldest descriptor not yet reclaimed
+static int tx_inflight;     // descriptors between tx_clean and tx_tail
+static char *tx_bufs[TX_RING_SIZE];  // buffer to free once each descriptor is sent
+// headers of scatter-gather packets; see e1000_transmit_sg().
+#define TX_HDR_SIZE 64
+// how often e1000_transmit_sg() checks whether its packet has
+// been sent, in time CSR ticks (10 MHz): about as long as a
+// full-sized frame takes on the wire at 1 Gb/s.
+#define TX_SG_POLL 120
+static char tx_hdrs[TX_RING_SIZE][TX_HDR_SIZE];
+static int tx_ctx_loaded;   // checksum offload context has been loaded; see e1000_txcontext()
+static uint64 tx_nqueued;   // descriptors ever queued
+static uint64 tx_ndone;     // descriptors ever reclaimed
+
 struct spinlock e1000_transmit_lock;
 struct spinlock e1000_recv_lock;
 
+// serializes reading the statistics registers into netstats;
+// see e1000_stats().
+static struct spinlock e1000_stats_lock;
+
+// Adaptive interrupt moderation. With RDTR = RADV = ITR = 0 the
+// e1000 interrupts once per received frame, which is what we want
+// for latency when traffic is light but swamps the cpu under load.
+// e1000_tick() measures the receive rate and moves between these
+// levels: higher levels cap the interrupt rate (ITR, in 256 ns
+// units) and let the rx delay timers (RDTR/RADV, in 1.024 us
+// units) collect several frames per interrupt.
+static struct {
+  uint32 minpps;  // enter this level at or above this rx rate
+  uint32 itr;
+  uint32 rdtr;
+  uint32 radv;
+} itr_levels[] = {
+  {     0,   0,  0,   0 },  // interrupt per frame
+  {  2000, 195,  8,  32 },  // at most ~20000 interrupts/s
+  { 10000, 488, 32, 128 },  // at most ~8000 interrupts/s
+  { 25000, 976, 64, 256 },  // at most ~4000 interrupts/s
+};
+static int itr_level;
+static uint rx_count;  // frames received since the last e1000_tick()
+
+// software copy of RDT: the last descriptor handed back to the
+// e1000. protected by e1000_recv_lock.
+static uint32 rx_tail;
+
+// Receive polling; see e1000_poll().
+#define RX_BUDGET 64    // packets per pass of the poller
+struct spinlock e1000_poll_lock;
+static int rx_pending;  // poller has work; protected by e1000_poll_lock
+static uint64 rx_intr_time; // r_time() of the interrupt that set rx_pending
+
 // called by pci_init().
 // xregs is the memory address at which the
 // e1000's registers are mapped.
@@ -31,6 +104,8 @@ e1000_init(uint32 *xregs)
 
   initlock(&e1000_transmit_lock, "e1000_transmit");
   initlock(&e1000_recv_lock, "e1000_recv");
+  initlock(&e1000_poll_lock, "e1000_poll");
+  initlock(&e1000_stats_lock, "e1000_stats");
 
   regs = xregs;
 
@@ -51,11 +126,14 @@ e1000_init(uint32 *xregs)
     panic("e1000");
   regs[E1000_TDLEN] = sizeof(tx_ring);
   regs[E1000_TDH] = regs[E1000_TDT] = 0;
+  tx_tail = tx_clean = 0;
+  tx_inflight = 0;
+  tx_ctx_loaded = 0;
 
   // [E1000 14.4] Receive initialization
   memset(rx_ring, 0, sizeof(rx_ring));
   for (i = 0; i < RX_RING_SIZE; i++) {
-    rx_ring[i].addr = (uint64) kalloc();
+    rx_ring[i].addr = (uint64) pbuf_alloc();
     if (!rx_ring[i].addr)
       panic("e1000");
   }
@@ -63,7 +141,7 @@ e1000_init(uint32 *xregs)
   if(sizeof(rx_ring) % 128 != 0)
     panic("e1000");
   regs[E1000_RDH] = 0;
-  regs[E1000_RDT] = RX_RING_SIZE - 1;
+  regs[E1000_RDT] = rx_tail = RX_RING_SIZE - 1;
   regs[E1000_RDLEN] = sizeof(rx_ring);
 
   // filter by qemu's MAC address, 52:54:00:12:34:56
@@ -80,6 +158,9 @@ e1000_init(uint32 *xregs)
     (0x40 << E1000_TCTL_COLD_SHIFT);
   regs[E1000_TIPG] = 10 | (8<<10) | (6<<20); // inter-pkt gap
 
+  // have the e1000 check IP and UDP checksums of received frames.
+  regs[E1000_RXCSUM] = E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL;
+
   // receiver control bits.
   regs[E1000_RCTL] = E1000_RCTL_EN | // enable receiver
     E1000_RCTL_BAM |                 // enable broadcast
@@ -87,75 +168,469 @@ e1000_init(uint32 *xregs)
     E1000_RCTL_SECRC;                // strip CRC
 
   // ask e1000 for receive interrupts.
-  regs[E1000_RDTR] = 0; // interrupt after every received packet (no timer)
-  regs[E1000_RADV] = 0; // interrupt after every packet (no timer)
-  regs[E1000_IMS] = (1 << 7); // RXDW -- Receiver Descriptor Write Back
+  // start at moderation level 0, interrupting for every packet;
+  // e1000_tick() raises the level if traffic picks up.
+  itr_level = 0;
+  regs[E1000_ITR] = itr_levels[0].itr;
+  regs[E1000_RDTR] = itr_levels[0].rdtr; // interrupt after every received packet (no timer)
+  regs[E1000_RADV] = itr_levels[0].radv; // interrupt after every packet (no timer)
+  regs[E1000_IMS] = E1000_ICR_RXT0 | // RXDW -- Receiver Descriptor Write Back
+    E1000_ICR_TXDW;                    // TXDW -- Transmit Descriptor Written Back
+}
+
+// Add the e1000's statistics registers into netstats. Each
+// register counts since it was last read, and clears when it's
+// read; the 64-bit octet counts clear when their high half is
+// read, so that's read last.
+void
+e1000_stats(void)
+{
+  if(regs == 0)
+    return;
+
+  acquire(&e1000_stats_lock);
+  netstats.hw_mpc += regs[E1000_MPC];
+  netstats.hw_rnbc += regs[E1000_RNBC];
+  netstats.hw_crcerrs += regs[E1000_CRCERRS];
+  netstats.hw_tpr += regs[E1000_TPR];
+  netstats.hw_gprc += regs[E1000_GPRC];
+  netstats.hw_gorc += regs[E1000_GORCL];
+  netstats.hw_gorc += (uint64)regs[E1000_GORCH] << 32;
+  netstats.hw_tpt += regs[E1000_TPT];
+  netstats.hw_gptc += regs[E1000_GPTC];
+  netstats.hw_gotc += regs[E1000_GOTCL];
+  netstats.hw_gotc += (uint64)regs[E1000_GOTCH] << 32;
+  release(&e1000_stats_lock);
+}
+
+// called by clockintr() on every tick (about 1/10th of a second).
+// picks an interrupt moderation level from the receive rate
+// over the last tick, and collects the statistics registers
+// every second, before the 32-bit ones can wrap.
+void
+e1000_tick(void)
+{
+  if(regs == 0)
+    return;
+
+  if(ticks % 10 == 0)
+    e1000_stats();
+
+  uint32 pps = __atomic_exchange_n(&rx_count, 0, __ATOMIC_RELAXED) * 10;
+  int level = itr_level;
+
+  while(level + 1 < NELEM(itr_levels) && pps >= itr_levels[level+1].minpps)
+    level++;
+  // step down a little below the threshold, so that a rate near
+  // a boundary doesn't flip between levels on every tick.
+  while(level > 0 && pps < itr_levels[level].minpps / 4 * 3)
+    level--;
+
+  if(level != itr_level){
+    itr_level = level;
+    regs[E1000_ITR] = itr_levels[level].itr;
+    regs[E1000_RDTR] = itr_levels[level].rdtr;
+    regs[E1000_RADV] = itr_levels[level].radv;
+  }
+}
+
+// current interrupt moderation level, 0 (none) and up.
+int
+e1000_moderation(void)
+{
+  return itr_level;
+}
+
+// Hand the descriptors up to and including last to the e1000,
+// asking it to report status (and interrupt) when it is done
+// with last.
+// caller must hold e1000_transmit_lock.
+static void
+e1000_txflush(uint32 last)
+{
+  tx_ring[last].cmd |= E1000_TXD_CMD_RS;
+
+  // Make the descriptors visible before the hardware is told about them.
+  __sync_synchronize();
+
+  // This is our signal to hardware to process.
+  regs[E1000_TDT] = tx_tail;
+}
+
+// Free the buffers of transmitted packets. Only the last
+// descriptor of each batch asks for status (RS), so the e1000
+// setting DD on it means the whole batch has been sent.
+// every in-flight descriptor must have been through
+// e1000_txflush().
+// caller must hold e1000_transmit_lock.
+static void
+e1000_txreclaim(void)
+{
+  int freed = 0;
+
+  while (tx_inflight > 0) {
+    // find the end of the oldest batch.
+    uint32 end = tx_clean;
+    while (!(tx_ring[end].cmd & E1000_TXD_CMD_RS))
+      end = TX_RING_NEXT(end);
+    if (!(tx_ring[end].status & E1000_TXD_STAT_DD))
+      break;
+
+    for (;;) {
+      if (tx_bufs[tx_clean]) {
+        pbuf_free(tx_bufs[tx_clean]);
+        tx_bufs[tx_clean] = 0;
+      }
+      tx_ring[tx_clean].addr = 0;
+      tx_ring[tx_clean].cmd = 0;
+      tx_inflight--;
+      tx_ndone++;
+      freed = 1;
+      if (tx_clean == end)
+        break;
+      tx_clean = TX_RING_NEXT(tx_clean);
+    }
+    tx_clean = TX_RING_NEXT(tx_clean);
+  }
+
+  if (freed)
+    wakeup(&tx_inflight);
+}
+
+// Load the checksum offload context into the e1000: where the
+// IP header checksum and the UDP checksum go in a frame built
+// by net.c (Ethernet, then a 20-byte IP header, then UDP). It
+// stays loaded for every later data descriptor that asks for
+// checksum insertion, so this is only needed once.
+// caller must hold e1000_transmit_lock and have a free descriptor.
+static void
+e1000_txcontext(void)
+{
+  struct tx_ctx_desc *ctx = (struct tx_ctx_desc *)&tx_ring[tx_tail];
+  int ipcss = sizeof(struct eth);
+  int tucss = ipcss + sizeof(struct ip);
+
+  ctx->ipcss = ipcss;
+  ctx->ipcso = ipcss + 10;                  // ip_sum
+  ctx->ipcse = tucss - 1;                   // last byte of IP header
+  ctx->tucss = tucss;
+  ctx->tucso = tucss + 6;                   // udp sum
+  ctx->tucse = 0;                           // to end of packet
+  ctx->cmd_and_length = E1000_TXD_CMD_DEXT | E1000_TXD_CMD_IP; // UDP over IPv4
+  ctx->status = 0;
+  ctx->hdr_len = 0;
+  ctx->mss = 0;
+
+  tx_bufs[tx_tail] = 0;
+  tx_tail = TX_RING_NEXT(tx_tail);
+  tx_inflight++;
+  tx_nqueued++;
+  tx_ctx_loaded = 1;
+}
+
+// Make room for need more descriptors in the ring.
+// *last is the last descriptor queued by the caller but not yet
+// handed to the e1000, or -1; it is flushed if need be.
+// Returns 1 if there is room, 0 if not (the ring is full and
+// flags doesn't include E1000_TX_WAIT, or the caller was killed
+// while waiting).
+// caller must hold e1000_transmit_lock.
+static int
+e1000_txroom(int need, int flags, int *last)
+{
+  int full = 0;
+
+  // TDT == TDH means an empty ring to the e1000,
+  // so one descriptor always stays unused.
+  while (tx_inflight + need > TX_RING_SIZE - 1) {
+    // e1000_txreclaim() expects every in-flight batch
+    // to end with RS, so hand over what we have first.
+    if (*last >= 0) {
+      e1000_txflush(*last);
+      *last = -1;
+    }
+    e1000_txreclaim();
+    if (tx_inflight + need <= TX_RING_SIZE - 1)
+      break;
+    if (!full++)
+      NETSTAT_INC(tx_ringfull);
+    if (!(flags & E1000_TX_WAIT) || killed(myproc()))
+      return 0;
+    sleep(&tx_inflight, &e1000_transmit_lock);
+  }
+  return 1;
+}
+
+// Queue one data descriptor for len bytes at physical address
+// addr. eop marks the last descriptor of a packet. freebuf, if
+// not 0, is freed once the e1000 has sent the descriptor.
+// caller must hold e1000_transmit_lock and have made room.
+static void
+e1000_txdesc(uint64 addr, int len, char *freebuf, int eop, int flags)
+{
+  struct tx_desc *desc = &tx_ring[tx_tail];
+
+  tx_bufs[tx_tail] = freebuf;
+  desc->addr = addr;
+  desc->length = len;
+  desc->cmd = eop ? E1000_TXD_CMD_EOP : 0;  // RS is left to e1000_txflush()
+  desc->status = 0;
+  if (flags & E1000_TX_CSUM) {
+    // an extended data descriptor, asking for the IP and
+    // UDP checksums to be inserted.
+    desc->cso = E1000_TXD_DTYP_D;
+    desc->cmd |= E1000_TXD_CMD_DEXT >> 24;
+    desc->css = E1000_TXD_POPTS_IXSM | E1000_TXD_POPTS_TXSM;
+  } else {
+    desc->cso = 0;
+    desc->css = 0;
+  }
+
+  tx_tail = TX_RING_NEXT(tx_tail);
+  tx_inflight++;
+  tx_nqueued++;
+  if (eop)
+    NETSTAT_INC(tx_frames);
+  if (tx_inflight > netstats.tx_hiwat)
+    netstats.tx_hiwat = tx_inflight;
 }
 
+// Queue n packets for transmission and ring the tail doorbell
+// once for the whole batch; each MMIO write to the e1000 costs
+// an exit into qemu.
+//
+// flags:
+//   E1000_TX_WAIT: if the ring is full, sleep until the e1000 has
+//     sent enough to make room, rather than stopping early.
+//   E1000_TX_CSUM: the packets are UDP/IPv4 frames as built by
+//     net.c, with ip_sum zero and the UDP pseudo-header sum in the
+//     UDP checksum field; have the e1000 fill in both checksums.
+//
+// Returns the number of packets queued, bufs[0] through
+// bufs[r-1], which now belong to the driver; it is less than n
+// only if the ring filled up without E1000_TX_WAIT, or if the
+// caller was killed while waiting.
 int
-e1000_transmit(char *buf, int len)
+e1000_transmitv(char **bufs, int *lens, int n, int flags)
 {
-  // First, acquire lock
+  int i;
+  int last = -1;  // last descriptor queued but not yet handed to the e1000
+
   acquire(&e1000_transmit_lock);
 
-  uint32 tx_next_ring_index = regs[E1000_TDT];
+  for (i = 0; i < n; i++) {
+    int ctx = (flags & E1000_TX_CSUM) && !tx_ctx_loaded;
+    if (!e1000_txroom(1 + ctx, flags, &last))
+      break;
+    if (ctx)
+      e1000_txcontext();
+
+    // capture it while it's still ours; once queued, it may be
+    // sent and freed at any moment.
+    if (capture_on)
+      capture_tap(CAP_TX, bufs[i], lens[i], 0, 0, 0);
+
+    // each packet is a single descriptor.
+    last = tx_tail;
+    e1000_txdesc((uint64)bufs[i], lens[i], bufs[i], 1, flags);
+  }
 
-  // If the next descriptor in the ring isn't yet finished (we've wrapped around), then we early return error.
-  if (!(tx_ring[tx_next_ring_index].status & E1000_TXD_STAT_DD)) {
-    release(&e1000_transmit_lock);
+  if (last >= 0)
+    e1000_txflush(last);
+
+  release(&e1000_transmit_lock);
+
+  return i;
+}
+
+int
+e1000_transmit(char *buf, int len, int flags)
+{
+  if (e1000_transmitv(&buf, &len, 1, flags) != 1)
+    return -1;
+  return 0;
+}
+
+// Send one packet gathered from several pieces of memory: the
+// hdrlen bytes at hdr, followed by nseg segments at physical
+// addresses segs[i], seglens[i] bytes each.
+// The header is copied into a buffer belonging to its descriptor
+// slot. The segments are typically the sender's own user pages,
+// so the payload is never copied; since nothing else keeps those
+// pages alive, this waits until the e1000 has finished with them.
+// flags are as for e1000_transmitv().
+// Returns 0 if sent, -1 if not.
+int
+e1000_transmit_sg(char *hdr, int hdrlen, uint64 *segs, int *seglens, int nseg, int flags)
+{
+  int last = -1;
+
+  if (hdrlen > TX_HDR_SIZE)
     return -1;
-  }
 
-  // Free the last buffer. When we loop around, we'll start freeing every time.
-  if (tx_ring[tx_next_ring_index].addr) {
-    kfree((void*)tx_ring[tx_next_ring_index].addr);  // Does not null our addr, so we do it.
-    tx_ring[tx_next_ring_index].addr = 0;
+  acquire(&e1000_transmit_lock);
+
+  int ctx = (flags & E1000_TX_CSUM) && !tx_ctx_loaded;
+  if (1 + nseg + ctx > TX_RING_SIZE - 1 || !e1000_txroom(1 + nseg + ctx, flags, &last)) {
+    release(&e1000_transmit_lock);
+    return -1;
   }
+  if (ctx)
+    e1000_txcontext();
 
-  tx_ring[tx_next_ring_index].addr = (uint64)buf;
-  tx_ring[tx_next_ring_index].length = len;
-  tx_ring[tx_next_ring_index].cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS; // End of Packet (Assumption is that each call and packet will be compromised of just one descriptor in the ring) and Report status so that we can spin on the hardware being finished with the descriptor.
-  tx_ring[tx_next_ring_index].status = 0;
+  if (capture_on)
+    capture_tap(CAP_TX, hdr, hdrlen, segs, seglens, nseg);
 
-  // This is our signal to hardware to process.
-  regs[E1000_TDT] = (tx_next_ring_index + 1) % TX_RING_SIZE;
+  memmove(tx_hdrs[tx_tail], hdr, hdrlen);
+  e1000_txdesc((uint64)tx_hdrs[tx_tail], hdrlen, 0, 0, flags);
+  for (int i = 0; i < nseg; i++) {
+    last = tx_tail;
+    e1000_txdesc(segs[i], seglens[i], 0, i == nseg - 1, flags);
+  }
+  e1000_txflush(last);
+
+  // Wait, even if killed, for the e1000 to be done with the
+  // segments; the caller may free them as soon as we return.
+  // With interrupt moderation on, TXDW may not come for a while
+  // after the e1000 has sent the packet, so look at DD again
+  // every TX_SG_POLL rather than waiting only for the interrupt.
+  uint64 mine = tx_nqueued;
+  for (;;) {
+    e1000_txreclaim();
+    if (tx_ndone >= mine)
+      break;
+    timedsleep(&tx_inflight, &e1000_transmit_lock, r_time() + TX_SG_POLL);
+  }
 
   release(&e1000_transmit_lock);
 
   return 0;
 }
 
-static void
-e1000_recv(void)
+// Translate a receive descriptor's checksum offload status into
+// net_rx()'s NET_RX_* flags. If the e1000 says to ignore its
+// checksum indication (IXSM), report nothing, and net.c checks
+// the checksums in software.
+static int
+e1000_rxcsum(struct rx_desc *desc)
+{
+  int csum = 0;
+
+  if (desc->status & E1000_RXD_STAT_IXSM)
+    return 0;
+  if (desc->status & E1000_RXD_STAT_IPCS)
+    csum |= (desc->errors & E1000_RXD_ERR_IPE) ? NET_RX_IP_BAD : NET_RX_IP_OK;
+  if (desc->status & E1000_RXD_STAT_TCPCS)
+    csum |= (desc->errors & E1000_RXD_ERR_TCPE) ? NET_RX_UDP_BAD : NET_RX_UDP_OK;
+  return csum;
+}
+
+// Hand up to budget received packets to the network stack,
+// stamped with the time each was taken off the ring. If intr
+// isn't 0, it's when the interrupt that started this pass
+// arrived. Returns how many there were; fewer than budget
+// means the ring has been drained.
+static int
+e1000_recv(int budget, uint64 intr)
 {
+  int n;
+
   acquire(&e1000_recv_lock);
 
-  // We will loop until we run out of descriptors to process.
-  while (1) {
-    uint32 rx_next_ring_index = (regs[E1000_RDT] + 1) % RX_RING_SIZE;
+  for (n = 0; n < budget; n++) {
+    uint32 rx_next_ring_index = RX_RING_NEXT(rx_tail);
 
     if (!(rx_ring[rx_next_ring_index].status & E1000_RXD_STAT_DD)) {
       // The next descriptor is not yet ready, we're finished looping.
-      release(&e1000_recv_lock);
-      return;
+      break;
     }
 
-    // Deliver the packet to kernel.
-    net_rx((char*)rx_ring[rx_next_ring_index].addr, rx_ring[rx_next_ring_index].length);
-
-    // Allocate empty page for buffer.
-    rx_ring[rx_next_ring_index].addr = (uint64) kalloc();
-    if (!rx_ring[rx_next_ring_index].addr)
-      panic("e1000 kalloc in e1000_recv()");
+    __atomic_fetch_add(&rx_count, 1, __ATOMIC_RELAXED);
+    NETSTAT_INC(rx_frames);
+    uint64 now = r_time();
+    if (n == 0 && intr)
+      rxlat_add(RXLAT_INTR, intr, now);
+
+    // Deliver the packet to kernel, and refill the slot with
+    // a recycled buffer. If there's none to be had, drop the
+    // packet and give its buffer back to the e1000 instead.
+    char *buf = pbuf_alloc();
+    if (buf) {
+      net_rx((char*)rx_ring[rx_next_ring_index].addr, rx_ring[rx_next_ring_index].length,
+             e1000_rxcsum(&rx_ring[rx_next_ring_index]), now);
+      rx_ring[rx_next_ring_index].addr = (uint64) buf;
+    } else {
+      NETSTAT_INC(rx_nobuf);
+    }
 
     // Clear status
     rx_ring[rx_next_ring_index].status = 0;
 
-    // Move RDT register forward
-    regs[E1000_RDT] = rx_next_ring_index;
+    rx_tail = rx_next_ring_index;
+  }
+
+  // Move RDT register forward, once for the whole batch.
+  if (n > 0) {
+    __sync_synchronize();
+    regs[E1000_RDT] = rx_tail;
+  }
+
+  release(&e1000_recv_lock);
+
+  return n;
+}
+
+// The receive poller. Rather than draining the ring inside the
+// interrupt handler, which under overload leaves the interrupted
+// hart doing nothing but receive (livelock), e1000_intr() masks
+// receive interrupts and wakes this kernel thread. It handles at
+// most RX_BUDGET packets per pass, yielding the cpu between
+// passes so that other processes (e.g. the ones consuming the
+// packets) get to run, and unmasks receive interrupts once the
+// ring is empty.
+static void
+e1000_poll(void)
+{
+  acquire(&e1000_poll_lock);
+  for (;;) {
+    while (!rx_pending)
+      sleep(&rx_pending, &e1000_poll_lock);
+    // cleared before the pass, so that an interrupt on another
+    // hart that reads RXT0 out of ICR while it's under way
+    // leaves it set, and isn't lost.
+    rx_pending = 0;
+    uint64 intr = rx_intr_time;
+    rx_intr_time = 0;
+    release(&e1000_poll_lock);
+
+    int n = e1000_recv(RX_BUDGET, intr);
+
+    acquire(&e1000_poll_lock);
+    if (n < RX_BUDGET) {
+      // Drained. A packet that arrived since the last check has
+      // either set its cause bit in ICR, so unmasking will
+      // interrupt right away, or been seen by e1000_intr(), which
+      // set rx_pending; go round again for that one.
+      if (!rx_pending)
+        regs[E1000_IMS] = E1000_ICR_RXT0;
+    } else {
+      rx_pending = 1;  // more to do
+      release(&e1000_poll_lock);
+      yield();
+      acquire(&e1000_poll_lock);
+    }
   }
+}
 
-  panic("e1000_recv unreachable");
+// called by main() once there are processes,
+// to start the receive poller.
+void
+e1000_startpoll(void)
+{
+  if (regs == 0)
+    return;
+  if (kthread_create(e1000_poll, "e1000_poll") < 0)
+    panic("e1000_startpoll");
 }
 
 void
@@ -164,7 +639,25 @@ e1000_intr(void)
   // tell the e1000 we've seen this interrupt;
   // without this the e1000 won't raise any
   // further interrupts.
-  regs[E1000_ICR] = 0xffffffff;
+  uint32 icr = regs[E1000_ICR];
+  regs[E1000_ICR] = icr;
+  NETSTAT_INC(intr);
+
+  // Free sent buffers and wake senders waiting for room.
+  if (icr & E1000_ICR_TXDW) {
+    acquire(&e1000_transmit_lock);
+    e1000_txreclaim();
+    release(&e1000_transmit_lock);
+  }
 
-  e1000_recv();
+  // Leave the receiving to e1000_poll(), with receive interrupts
+  // masked until it has caught up.
+  if (icr & E1000_ICR_RXT0) {
+    regs[E1000_IMC] = E1000_ICR_RXT0;
+    acquire(&e1000_poll_lock);
+    rx_pending = 1;
+    rx_intr_time = r_time();
+    wakeup(&rx_pending);
+    release(&e1000_poll_lock);
+  }
 }
@@ -6,7 +6,9 @@
 /* Registers */
 #define E1000_CTL      (0x00000/4)  /* Device Control Register - RW */
 #define E1000_ICR      (0x000C0/4)  /* Interrupt Cause Read - R */
+#define E1000_ITR      (0x000C4/4)  /* Interrupt Throttling Rate - RW */
 #define E1000_IMS      (0x000D0/4)  /* Interrupt Mask Set - RW */
+#define E1000_IMC      (0x000D8/4)  /* Interrupt Mask Clear - WO */
 #define E1000_RCTL     (0x00100/4)  /* RX Control - RW */
 #define E1000_TCTL     (0x00400/4)  /* TX Control - RW */
 #define E1000_TIPG     (0x00410/4)  /* TX Inter-packet gap -RW */
@@ -20,9 +22,25 @@
 #define E1000_TDLEN    (0x03808/4)  /* TX Descriptor Length - RW */
 #define E1000_TDH      (0x03810/4)  /* TX Descriptor Head - RW */
 #define E1000_TDT      (0x03818/4)  /* TX Descriptor Tail - RW */
+#define E1000_RXCSUM   (0x05000/4)  /* RX Checksum Control - RW */
+#define E1000_CRCERRS  (0x04000/4)  /* CRC Error Count - R/clr */
+#define E1000_MPC      (0x04010/4)  /* Missed Packet Count - R/clr */
+#define E1000_GPRC     (0x04074/4)  /* Good Packets RX Count - R/clr */
+#define E1000_GPTC     (0x04080/4)  /* Good Packets TX Count - R/clr */
+#define E1000_GORCL    (0x04088/4)  /* Good Octets RX Count Low - R/clr */
+#define E1000_GORCH    (0x0408C/4)  /* Good Octets RX Count High - R/clr */
+#define E1000_GOTCL    (0x04090/4)  /* Good Octets TX Count Low - R/clr */
+#define E1000_GOTCH    (0x04094/4)  /* Good Octets TX Count High - R/clr */
+#define E1000_RNBC     (0x040A0/4)  /* RX No Buffers Count - R/clr */
+#define E1000_TPR      (0x040D0/4)  /* Total Packets RX - R/clr */
+#define E1000_TPT      (0x040D4/4)  /* Total Packets TX - R/clr */
 #define E1000_MTA      (0x05200/4)  /* Multicast Table Array - RW Array */
 #define E1000_RA       (0x05400/4)  /* Receive Address - RW Array */
 
+/* Interrupt Cause / Mask bits */
+#define E1000_ICR_TXDW    0x00000001    /* Transmit desc written back */
+#define E1000_ICR_RXT0    0x00000080    /* rx timer intr (ring 0) */
+
 /* Device Control */
 #define E1000_CTL_RST     0x04000000    /* full reset */
 
@@ -38,10 +56,21 @@
 #define E1000_RCTL_SZ_2048        0x00000000    /* rx buffer size 2048 */
 #define E1000_RCTL_SECRC          0x04000000    /* Strip Ethernet CRC */
 
+/* Receive Checksum Control */
+#define E1000_RXCSUM_IPOFL        0x00000100    /* IPv4 checksum offload */
+#define E1000_RXCSUM_TUOFL        0x00000200    /* TCP / UDP checksum offload */
+
 /* Transmit Descriptor command definitions [E1000 3.3.3.1] */
 #define E1000_TXD_CMD_EOP    0x01 /* End of Packet */
 #define E1000_TXD_CMD_RS     0x08 /* Report Status */
 
+/* Context and extended data descriptor definitions [E1000 3.3.6, 3.3.7] */
+#define E1000_TXD_CMD_DEXT   0x20000000 /* Descriptor extension (0 = legacy) */
+#define E1000_TXD_CMD_IP     0x02000000 /* IP packet (0 = IPv6) */
+#define E1000_TXD_DTYP_D     0x10       /* Data descriptor, in the cso byte */
+#define E1000_TXD_POPTS_IXSM 0x01       /* Insert IP checksum */
+#define E1000_TXD_POPTS_TXSM 0x02       /* Insert TCP/UDP checksum */
+
 /* Transmit Descriptor status definitions [E1000 3.3.3.2] */
 #define E1000_TXD_STAT_DD    0x00000001 /* Descriptor Done */
 
@@ -57,9 +86,30 @@ struct tx_desc
   uint16 special;
 };
 
+// [E1000 3.3.6] Transmit Context Descriptor Format.
+// shares a slot in the tx ring with data descriptors.
+struct tx_ctx_desc
+{
+  uint8 ipcss;      /* IP checksum start */
+  uint8 ipcso;      /* IP checksum offset */
+  uint16 ipcse;     /* IP checksum end */
+  uint8 tucss;      /* TCP/UDP checksum start */
+  uint8 tucso;      /* TCP/UDP checksum offset */
+  uint16 tucse;     /* TCP/UDP checksum end (0 = end of packet) */
+  uint32 cmd_and_length;
+  uint8 status;
+  uint8 hdr_len;
+  uint16 mss;
+};
+
 /* Receive Descriptor bit definitions [E1000 3.2.3.1] */
 #define E1000_RXD_STAT_DD       0x01    /* Descriptor Done */
 #define E1000_RXD_STAT_EOP      0x02    /* End of Packet */
+#define E1000_RXD_STAT_IXSM     0x04    /* Ignore checksum */
+#define E1000_RXD_STAT_TCPCS    0x20    /* TCP/UDP checksum calculated */
+#define E1000_RXD_STAT_IPCS     0x40    /* IP checksum calculated */
+#define E1000_RXD_ERR_TCPE      0x20    /* TCP/UDP checksum error */
+#define E1000_RXD_ERR_IPE       0x40    /* IP checksum error */
 
 // [E1000 3.2.3]
 struct rx_desc
@@ -0,0 +1,243 @@
+//
+// epoll: a persistent set of file descriptors to wait on.
+//
+// unlike poll(), which registers with every file on each call,
+// an epoll keeps a pollentry registered with each file it
+// watches for as long as the file is in the set. pollwake()
+// puts the entry on the epoll's ready list when the file's
+// state changes, and epoll_wait() only looks at that list, so
+// its cost depends on how many files are active rather than on
+// how many are watched.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+
+struct epitem {
+  struct pollentry pe;   // pe.idx is the fd it was added as
+  struct epitem *next;   // on the epoll's list, or the free list
+};
+
+struct epoll {
+  struct sleeplock lock; // protects items, and the items themselves
+  struct pollwait pw;
+  struct epitem *items;
+};
+
+// epitems are carved out of kalloc()ed pages and recycled
+// through a free list.
+static struct spinlock epitem_lock;
+static struct epitem *epitem_freelist;
+
+void
+epollinit(void)
+{
+  initlock(&epitem_lock, "epitem");
+}
+
+static struct epitem *
+epitem_alloc(void)
+{
+  struct epitem *it;
+
+  acquire(&epitem_lock);
+  if(epitem_freelist == 0){
+    char *page = kalloc();
+    if(page == 0){
+      release(&epitem_lock);
+      return 0;
+    }
+    for(it = (struct epitem *)page; (char*)(it + 1) <= page + PGSIZE; it++){
+      it->next = epitem_freelist;
+      epitem_freelist = it;
+    }
+  }
+  it = epitem_freelist;
+  epitem_freelist = it->next;
+  release(&epitem_lock);
+
+  memset(it, 0, sizeof(*it));
+  return it;
+}
+
+static void
+epitem_free(struct epitem *it)
+{
+  acquire(&epitem_lock);
+  it->next = epitem_freelist;
+  epitem_freelist = it;
+  release(&epitem_lock);
+}
+
+int
+epollalloc(struct file **f)
+{
+  struct epoll *ep;
+
+  ep = 0;
+  *f = 0;
+  if((*f = filealloc()) == 0)
+    goto bad;
+  if((ep = (struct epoll*)kalloc()) == 0)
+    goto bad;
+  initsleeplock(&ep->lock, "epoll");
+  pollwaitinit(&ep->pw);
+  ep->items = 0;
+  (*f)->type = FD_EPOLL;
+  (*f)->readable = 0;
+  (*f)->writable = 0;
+  (*f)->ep = ep;
+  return 0;
+
+ bad:
+  if(ep)
+    kfree((char*)ep);
+  if(*f)
+    fileclose(*f);
+  return -1;
+}
+
+// stop watching the item's file, and let go of it.
+// caller must hold ep->lock and have taken it off ep->items.
+static void
+epitem_remove(struct epitem *it)
+{
+  pollunregister(&it->pe);
+  pollunready(&it->pe);
+  fileclose(it->pe.f);
+  epitem_free(it);
+}
+
+void
+epollclose(struct epoll *ep)
+{
+  struct epitem *it;
+
+  acquiresleep(&ep->lock);
+  while((it = ep->items) != 0){
+    ep->items = it->next;
+    epitem_remove(it);
+  }
+  releasesleep(&ep->lock);
+  kfree((char*)ep);
+}
+
+// add, change or delete the entry for file f, open as fd.
+// the epoll holds a reference to f until the entry is deleted
+// or the epoll is closed, so closing fd alone doesn't stop it
+// being watched. f is 0 if fd has been closed since it was
+// added; then only EPOLL_CTL_DEL works, finding the entry by
+// fd alone, so that it can still let go of the file.
+int
+epollctl(struct epoll *ep, int op, int fd, struct file *f, int events)
+{
+  struct epitem *it, **pp;
+  int r;
+
+  if(f == 0 && op != EPOLL_CTL_DEL)
+    return -1;
+  if(f && f->type == FD_EPOLL)
+    return -1;  // no epolls in epolls
+
+  acquiresleep(&ep->lock);
+  for(pp = &ep->items; (it = *pp) != 0; pp = &it->next)
+    if(it->pe.idx == fd && (f == 0 || it->pe.f == f))
+      break;
+
+  r = -1;
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(it != 0 || (it = epitem_alloc()) == 0)
+      break;
+    it->pe.f = filedup(f);
+    it->pe.idx = fd;
+    it->pe.events = events;
+    it->pe.pw = &ep->pw;
+    it->next = ep->items;
+    ep->items = it;
+    // report it if it's ready already.
+    if(filepoll(f, &it->pe) & (events | POLLHUP))
+      pollready(&it->pe);
+    r = 0;
+    break;
+  case EPOLL_CTL_MOD:
+    if(it == 0)
+      break;
+    // the entry's events are read by pollwake(), under the
+    // file's lock; re-register rather than race with it.
+    pollunregister(&it->pe);
+    it->pe.events = events;
+    if(filepoll(f, &it->pe) & (events | POLLHUP))
+      pollready(&it->pe);
+    r = 0;
+    break;
+  case EPOLL_CTL_DEL:
+    if(it == 0)
+      break;
+    *pp = it->next;
+    epitem_remove(it);
+    r = 0;
+    break;
+  }
+  releasesleep(&ep->lock);
+  return r;
+}
+
+// wait for entries to be ready, for up to timeout milliseconds
+// (-1 for as long as it takes), and copy up to max of them out
+// to the struct epoll_events at user address addr.
+// returns the number copied out, or -1.
+int
+epollwait(struct epoll *ep, uint64 addr, int max, int timeout)
+{
+  struct proc *p = myproc();
+  struct epoll_event ev;
+  struct pollentry *list, *e, *next;
+  uint64 deadline = timeout > 0 ? timer_deadline(timeout) : 0;
+  int n;
+
+  for(;;){
+    acquiresleep(&ep->lock);
+    list = polltake(&ep->pw);
+    if(list || timeout == 0 || (deadline && r_time() >= deadline))
+      break;
+    releasesleep(&ep->lock);
+    pollsleep(&ep->pw, deadline);
+    if(killed(p))
+      return -1;
+  }
+
+  // only the entries on the ready list are looked at. a
+  // level-triggered entry that's still ready goes back on
+  // the list for next time, as does any that doesn't fit.
+  n = 0;
+  for(e = list; e; e = next){
+    next = pollnext(e);
+    int r = filepoll(e->f, 0) & (e->events | POLLHUP);
+    if(r == 0)
+      continue;  // not ready after all; wait for the next change
+    if(n >= 0 && n < max){
+      ev.fd = e->idx;
+      ev.events = r;
+      if(copyout(p->pagetable, addr + n * sizeof(ev), (char *)&ev, sizeof(ev)) < 0){
+        n = -1;
+      } else {
+        n++;
+        if(e->events & EPOLLET)
+          continue;
+      }
+    }
+    pollready(e);
+  }
+  releasesleep(&ep->lock);
+
+  return n;
+}
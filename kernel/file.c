@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -75,6 +76,12 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
+  } else if(ff.type == FD_EPOLL){
+    epollclose(ff.ep);
+#ifdef LAB_NET
+  } else if(ff.type == FD_SOCK){
+    sockclose(ff.sock);
+#endif
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
     begin_op();
     iput(ff.ip);
@@ -113,6 +120,10 @@ fileread(struct file *f, uint64 addr, int n)
 
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
+#ifdef LAB_NET
+  } else if(f->type == FD_SOCK){
+    r = sockread(f->sock, addr, n);
+#endif
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
@@ -141,6 +152,10 @@ filewrite(struct file *f, uint64 addr, int n)
 
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
+#ifdef LAB_NET
+  } else if(f->type == FD_SOCK){
+    ret = sockwrite(f->sock, addr, n);
+#endif
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
@@ -178,3 +193,34 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Which of POLLIN, POLLOUT and POLLHUP file f is ready for.
+// If e isn't 0, also register e to be woken up when that
+// may have changed; see poll.c.
+int
+filepoll(struct file *f, struct pollentry *e)
+{
+  int r;
+
+  if(f->type == FD_PIPE){
+    r = pipepoll(f->pipe, f->writable, e);
+  } else if(f->type == FD_EPOLL){
+    return POLLNVAL;
+#ifdef LAB_NET
+  } else if(f->type == FD_SOCK){
+    r = sockpoll(f->sock, e);
+#endif
+  } else if(f->type == FD_DEVICE &&
+            f->major >= 0 && f->major < NDEV && devsw[f->major].poll){
+    r = devsw[f->major].poll(e);
+  } else {
+    // never has to wait.
+    r = POLLIN | POLLOUT;
+  }
+
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
@@ -1,5 +1,5 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SOCK, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
@@ -7,6 +7,8 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  struct sock *sock; // FD_SOCK
+  struct epoll *ep;  // FD_EPOLL
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -29,13 +31,49 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+// in-kernel poll machinery.
+//
+// a file that can be polled has a pollhead, a list of the
+// pollentries of those waiting for it, protected by the lock
+// that protects the rest of the file's state. when that state
+// changes, pollwake() puts each interested entry on its
+// pollwait's ready list and wakes the waiter up, which then
+// need only look at the entries on the list.
+//
+// lock order: the file's lock, then pollwait.lock.
+
+struct pollwait {
+  struct spinlock lock;
+  struct pollentry *ready;  // entries woken since last looked at
+};
+
+struct pollentry {
+  struct file *f;
+  int idx;                  // the waiter's own use
+  int events;               // what the waiter is interested in
+  struct pollwait *pw;
+  struct pollhead *head;    // registered on, or 0
+  struct spinlock *lock;    // head's lock
+  struct pollentry *next;   // on head's list
+  struct pollentry *rnext;  // on pw's ready list
+  int ready;                // on pw's ready list
+};
+
+struct pollhead {
+  struct pollentry *first;
+};
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollentry *);  // optional; see filepoll()
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
 #define STATS   2
+#define NETSTAT 3
+#define RXLAT   4
+#define CAPTURE 5
@@ -0,0 +1,259 @@
+//
+// IP reassembly.
+//
+// fragments of a datagram are held, in their receive buffers,
+// on an entry keyed by source, destination, protocol and id
+// until they cover the whole datagram. the finished datagram is
+// passed on as a chain of those buffers, linked through a
+// struct ipfrag written over the headers at the start of each
+// (see net.h), so the data is never copied.
+//
+// the cache is bounded: at most NREASS datagrams and
+// REASS_MAXBUFS buffers are held at once, the oldest datagram
+// being dropped to make room, and a datagram that isn't complete
+// within REASS_TIMEOUT ticks is dropped by ipfrag_tick().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "net.h"
+
+#define NREASS        8    // datagrams being reassembled at once
+#define REASS_MAXBUFS 128  // receive buffers held, over all datagrams
+#define REASS_TIMEOUT 30   // ticks a datagram has to be completed
+
+struct reass {
+  int used;
+  uint32 src, dst;    // network byte order, as in the header
+  uint16 id;
+  uint8 proto;
+  uint start;         // ticks when the first fragment arrived
+  int total;          // length of the data, once the last fragment is in; else -1
+  int have;           // bytes of data held
+  int nbuf;
+  char *frags;        // sorted by offset, not overlapping
+};
+
+// reasslock protects all of it.
+static struct spinlock reasslock;
+static struct reass reasstab[NREASS];
+static int reass_nbuf;
+
+void
+ipfraginit(void)
+{
+  initlock(&reasslock, "reass");
+}
+
+// free a chain of fragment buffers.
+void
+ipfrag_free(char *chain)
+{
+  while(chain){
+    char *next = ((struct ipfrag *)chain)->next;
+    pbuf_free(chain);
+    chain = next;
+  }
+}
+
+// forget r, freeing what it holds.
+// caller must hold reasslock.
+static void
+reass_drop(struct reass *r)
+{
+  NETSTAT_ADD(rx_reass, r->nbuf);
+  ipfrag_free(r->frags);
+  reass_nbuf -= r->nbuf;
+  r->frags = 0;
+  r->nbuf = 0;
+  r->used = 0;
+}
+
+// drop the oldest datagram other than keep.
+// returns 0 if there's nothing to drop.
+// caller must hold reasslock.
+static int
+reass_evict(struct reass *keep)
+{
+  struct reass *r, *victim = 0;
+
+  for(r = reasstab; r < reasstab + NREASS; r++)
+    if(r->used && r != keep &&
+       (victim == 0 || ticks - r->start > ticks - victim->start))
+      victim = r;
+  if(victim == 0)
+    return 0;
+  reass_drop(victim);
+  return 1;
+}
+
+// the end of the data held so far.
+// caller must hold reasslock.
+static int
+reass_end(struct reass *r)
+{
+  struct ipfrag *f = 0;
+
+  for(char *b = r->frags; b; b = f->next)
+    f = (struct ipfrag *)b;
+  return f ? f->off + f->len : 0;
+}
+
+// find the entry for a datagram, or make one.
+// caller must hold reasslock.
+static struct reass *
+reass_get(uint32 src, uint32 dst, uint16 id, uint8 proto)
+{
+  struct reass *r, *free = 0;
+
+  for(r = reasstab; r < reasstab + NREASS; r++){
+    if(r->used && r->src == src && r->dst == dst &&
+       r->id == id && r->proto == proto)
+      return r;
+    if(!r->used && free == 0)
+      free = r;
+  }
+
+  if(free == 0){
+    reass_evict(0);
+    for(free = reasstab; free->used; free++)
+      ;
+  }
+  free->used = 1;
+  free->src = src;
+  free->dst = dst;
+  free->id = id;
+  free->proto = proto;
+  free->start = ticks;
+  free->total = -1;
+  free->have = 0;
+  free->nbuf = 0;
+  free->frags = 0;
+  return free;
+}
+
+//
+// take a received IP fragment, a frame of len bytes in buf,
+// whose IP header the caller has checked.
+// returns 0 if buf has been kept (or dropped) and the datagram
+// isn't complete yet. otherwise returns the datagram as a chain
+// of fragment buffers, in order, and sets *plen to the length of
+// its data, i.e. the datagram less the IP header.
+//
+char *
+ip_reass(char *buf, int len, int *plen)
+{
+  struct ip *ip = (struct ip *)(buf + sizeof(struct eth));
+  int hlen = (ip->ip_vhl & 0xf) * 4;
+  int iplen = ntohs(ip->ip_len);
+  int off = (ntohs(ip->ip_off) & IP_OFFMASK) * 8;
+  int more = ntohs(ip->ip_off) & IP_MF;
+  int n = iplen - hlen;
+
+  // every fragment but the last holds a multiple of 8 bytes, and
+  // the first must hold at least a UDP header.
+  if(hlen < sizeof(struct ip) || n <= 0 || sizeof(struct eth) + iplen > len ||
+     (more && (n & 7)) || off + n > 0xffff - hlen ||
+     (off == 0 && n < sizeof(struct udp))){
+    NETSTAT_INC(rx_reass);
+    pbuf_free(buf);
+    return 0;
+  }
+
+  // read the header before the struct ipfrag overwrites it.
+  uint32 src = ip->ip_src;
+  uint32 dst = ip->ip_dst;
+  uint16 id = ip->ip_id;
+  uint8 proto = ip->ip_p;
+  struct ipfrag *f = (struct ipfrag *)buf;
+  f->data = (char *)ip + hlen;
+  f->off = off;
+  f->len = n;
+  f->next = 0;
+
+  acquire(&reasslock);
+  struct reass *r = reass_get(src, dst, id, proto);
+
+  // the last fragment says how long the datagram is; none of
+  // the others may go past that.
+  if(!more){
+    if((r->total >= 0 && r->total != off + n) || reass_end(r) > off + n)
+      goto bad;
+    r->total = off + n;
+  } else if(r->total >= 0 && off + n > r->total){
+    goto bad;
+  }
+
+  // find f's place, and drop it if it overlaps a neighbor;
+  // that's usually a duplicate.
+  char **pp;
+  struct ipfrag *prev = 0;
+  for(pp = &r->frags; *pp; pp = &((struct ipfrag *)*pp)->next){
+    struct ipfrag *g = (struct ipfrag *)*pp;
+    if(g->off >= off)
+      break;
+    prev = g;
+  }
+  if((prev && prev->off + prev->len > off) ||
+     (*pp && off + n > ((struct ipfrag *)*pp)->off)){
+    release(&reasslock);
+    NETSTAT_INC(rx_reass);
+    pbuf_free(buf);
+    return 0;
+  }
+
+  // keep within the memory limit.
+  while(reass_nbuf >= REASS_MAXBUFS)
+    if(!reass_evict(r))
+      goto bad;
+
+  f->next = *pp;
+  *pp = buf;
+  r->nbuf++;
+  reass_nbuf++;
+  r->have += n;
+
+  if(r->total < 0 || r->have < r->total){
+    release(&reasslock);
+    return 0;
+  }
+
+  // no overlaps, so having it all means there are no holes.
+  char *chain = r->frags;
+  *plen = r->total;
+  reass_nbuf -= r->nbuf;
+  r->frags = 0;
+  r->nbuf = 0;
+  r->used = 0;
+  release(&reasslock);
+  return chain;
+
+ bad:
+  reass_drop(r);
+  release(&reasslock);
+  NETSTAT_INC(rx_reass);
+  pbuf_free(buf);
+  return 0;
+}
+
+//
+// called by the clock interrupt on cpu 0 every tick.
+// drops datagrams that have taken too long to arrive.
+//
+void
+ipfrag_tick(void)
+{
+  if(ticks % 10 != 0)
+    return;
+
+  acquire(&reasslock);
+  for(struct reass *r = reasstab; r < reasstab + NREASS; r++)
+    if(r->used && ticks - r->start >= REASS_TIMEOUT)
+      reass_drop(r);
+  release(&reasslock);
+}
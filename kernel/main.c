@@ -25,17 +25,23 @@ main()
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
+    timerlistinit(); // timed sleeps
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    epollinit();     // epoll items
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
+    pbufinit();      // packet buffers
     pci_init();
     netinit();
 #endif    
     userinit();      // first user process
+#ifdef LAB_NET
+    e1000_startpoll(); // e1000 receive poller thread
+#endif
 #ifdef KCSAN
     kcsaninit();
 #endif
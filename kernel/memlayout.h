@@ -58,6 +58,7 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   UCLOCK (read-only, shared by every process)
 //   USYSCALL (shared with kernel)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
@@ -69,3 +70,11 @@ struct usyscall {
   int pid;  // Process ID
 };
 #endif
+
+// the clock page, which user code reads along with the time
+// CSR to tell the time without a system call (see timer.c).
+#define UCLOCK (TRAPFRAME - 2*PGSIZE)
+
+struct uclock {
+  uint64 freq;  // time CSR ticks per second
+};
@@ -8,56 +8,329 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 #include "net.h"
 
 // xv6's ethernet and IP addresses
-static uint8 local_mac[ETHADDR_LEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
-static uint32 local_ip = MAKE_IP_ADDR(10, 0, 2, 15);
-
-// qemu host's ethernet address.
-static uint8 host_mac[ETHADDR_LEN] = { 0x52, 0x55, 0x0a, 0x00, 0x02, 0x02 };
+uint8 local_mac[ETHADDR_LEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+uint32 local_ip = MAKE_IP_ADDR(10, 0, 2, 15);
 
+// serializes bind and unbind, and protects port_freelist.
 static struct spinlock netlock;
 
 // UDP port management structures
-#define NPORTS 32
+#define NPORTHASH 1024  // buckets in the port table; a power of two
 #define QUEUESIZE 16  // Increased from 16 to handle burst traffic
 
+// A queued datagram. Rather than copying the payload out of the
+// e1000 receive buffer, the queue holds on to that buffer and
+// remembers where the UDP payload lives inside it; sys_recv()
+// copies straight from there to user space and then frees it.
+// A datagram that arrived in fragments is held the same way, as
+// the chain of buffers that reassembly made of them.
 struct packet {
-  char data[2048];
-  int len;
+  char *buf;        // e1000 rx buffer (freed after dequeue)
+  char *payload;    // start of UDP payload within buf
+  int len;          // payload length
+  int frags;        // buf heads a chain of fragments; see ipfrag.c
   uint32 src_ip;
   uint16 src_port;
+  int woke;         // a receiver was asleep on the port when it was queued
+  uint64 stamp[NRXSTAMP]; // r_time() at each stage; see RXSTAMP_*
 };
 
 struct port_entry {
+  struct spinlock lock;     // protects everything below
   int bound;
   uint16 port;
+  struct port_entry *next;  // hash chain (bucket lock), or free list (netlock)
+  int ref;    // system calls and sockets currently using this entry
   struct packet queue[QUEUESIZE];
   int head;
   int tail;
   int count;
   int drops;  // Track dropped packets
+  int hiwat;  // most ever queued at once
+  int nwait;  // processes asleep in recv() or recvmmsg()
+  uint64 rx;  // datagrams queued
+  struct pollhead ph;  // poll()ers of a socket on this port
 };
 
-static struct port_entry ports[NPORTS];
+// Bound ports, hashed on port number so that bind, recv and
+// the receive interrupt find a port in constant time no matter
+// how many are bound. Each bucket's lock protects its chain,
+// and each port has its own lock for its queue, so delivery
+// and recv() on different ports don't contend with each other.
+//
+// lock order: netlock, then bucket lock, then port lock.
+struct portbucket {
+  struct spinlock lock;
+  struct port_entry *head;
+};
+
+static struct portbucket porthash[NPORTHASH];
+
+// port_entries are much smaller than a page, so they are carved
+// out of kalloc()ed pages and recycled through a free list.
+// protected by netlock.
+static struct port_entry *port_freelist;
+
+// socks are carved out of kalloc()ed pages and recycled through
+// a free list too, protected by sock_lock.
+static struct spinlock sock_lock;
+static struct sock *sock_freelist;
+
+// copy up to n bytes of pkt's payload to user address addr.
+// returns the number of bytes copied, or -1.
+static int
+packet_copyout(struct packet *pkt, uint64 addr, int n)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+
+  if(n > pkt->len)
+    n = pkt->len;
+  if(!pkt->frags){
+    if(copyout(pagetable, addr, pkt->payload, n) < 0)
+      return -1;
+    rxlat_add(RXLAT_COPY, pkt->stamp[RXSTAMP_DEQ], r_time());
+    return n;
+  }
+
+  // the first fragment's data starts with the UDP header.
+  int skip = sizeof(struct udp);
+  int done = 0;
+  for(char *b = pkt->buf; b && done < n; b = ((struct ipfrag *)b)->next){
+    struct ipfrag *f = (struct ipfrag *)b;
+    int m = f->len - skip;
+    if(m > n - done)
+      m = n - done;
+    if(copyout(pagetable, addr + done, f->data + skip, m) < 0)
+      return -1;
+    done += m;
+    skip = 0;
+  }
+  rxlat_add(RXLAT_COPY, pkt->stamp[RXSTAMP_DEQ], r_time());
+  return done;
+}
+
+static void
+packet_free(struct packet *pkt)
+{
+  if(pkt->frags)
+    ipfrag_free(pkt->buf);
+  else
+    pbuf_free(pkt->buf);
+}
 
 void
 netinit(void)
 {
   initlock(&netlock, "netlock");
+  initlock(&sock_lock, "sock");
+  arpinit();
+  ipfraginit();
+  netstatinit();
+  captureinit();
+  for(int i = 0; i < NPORTHASH; i++)
+    initlock(&porthash[i].lock, "porthash");
+}
+
+static inline struct portbucket *
+port_bucket(uint16 port)
+{
+  return &porthash[port & (NPORTHASH - 1)];
+}
+
+// find the entry for a bound port, and lock it.
+static struct port_entry *
+port_lookup(uint16 port)
+{
+  struct portbucket *b = port_bucket(port);
+  struct port_entry *pe;
+
+  acquire(&b->lock);
+  for(pe = b->head; pe; pe = pe->next){
+    if(pe->port == port){
+      acquire(&pe->lock);
+      break;
+    }
+  }
+  release(&b->lock);
+  return pe;
+}
+
+// caller must hold netlock.
+static struct port_entry *
+port_alloc(void)
+{
+  struct port_entry *pe;
+
+  if(port_freelist == 0){
+    char *page = kalloc();
+    if(page == 0)
+      return 0;
+    for(pe = (struct port_entry *)page; (char*)(pe + 1) <= page + PGSIZE; pe++){
+      pe->next = port_freelist;
+      port_freelist = pe;
+    }
+  }
+  pe = port_freelist;
+  port_freelist = pe->next;
+  memset(pe, 0, sizeof(*pe));
+  initlock(&pe->lock, "port");
+  return pe;
+}
+
+// find a bound port, lock it, and hold a reference to it so
+// that it isn't freed if unbind() runs while the port's lock
+// is released (e.g. while sleeping).
+static struct port_entry *
+port_get(uint16 port)
+{
+  struct port_entry *pe = port_lookup(port);
+  if(pe)
+    pe->ref++;
+  return pe;
+}
+
+// drop a reference from port_get() and release the port's lock,
+// freeing the entry if it has been unbound and this was the
+// last user.
+static void
+port_put(struct port_entry *pe)
+{
+  int dead = (--pe->ref == 0 && !pe->bound);
+  release(&pe->lock);
+
+  if(dead){
+    acquire(&netlock);
+    pe->next = port_freelist;
+    port_freelist = pe;
+    release(&netlock);
+  }
+}
+
+// fill in up to max of ps with the bound ports' queue statistics,
+// for the netstat device. returns the number of bound ports,
+// which may be more than max.
+int
+net_portstats(struct netstat_port *ps, int max)
+{
+  int n = 0;
+
+  for(int i = 0; i < NPORTHASH; i++){
+    struct portbucket *b = &porthash[i];
+    acquire(&b->lock);
+    for(struct port_entry *pe = b->head; pe; pe = pe->next, n++){
+      if(n >= max)
+        continue;
+      acquire(&pe->lock);
+      ps[n].port = pe->port;
+      ps[n].depth = pe->count;
+      ps[n].hiwat = pe->hiwat;
+      ps[n].pad = 0;
+      ps[n].rx = pe->rx;
+      ps[n].drops = pe->drops;
+      release(&pe->lock);
+    }
+    release(&b->lock);
+  }
+  return n;
+}
+
+// bind port, returning its entry with a reference held but not
+// locked. if the port is already bound, returns its existing
+// entry, or 0 if excl is set.
+static struct port_entry *
+port_bind(uint16 port, int excl)
+{
+  struct portbucket *b = port_bucket(port);
+  struct port_entry *pe;
+
+  acquire(&netlock);
 
-  // Initialize all port entries
-  for(int i = 0; i < NPORTS; i++) {
-    ports[i].bound = 0;
-    ports[i].port = 0;
-    ports[i].head = 0;
-    ports[i].tail = 0;
-    ports[i].count = 0;
-    ports[i].drops = 0;
+  // Check if port is already bound
+  acquire(&b->lock);
+  for(pe = b->head; pe; pe = pe->next) {
+    if(pe->port == port) {
+      if(excl) {
+        pe = 0;
+      } else {
+        acquire(&pe->lock);
+        pe->ref++;
+        release(&pe->lock);
+      }
+      release(&b->lock);
+      release(&netlock);
+      return pe;
+    }
   }
+  release(&b->lock);
+
+  pe = port_alloc();
+  if(!pe) {
+    release(&netlock);
+    return 0;
+  }
+  pe->bound = 1;
+  pe->port = port;
+  pe->ref = 1;
+
+  acquire(&b->lock);
+  pe->next = b->head;
+  b->head = pe;
+  release(&b->lock);
+
+  release(&netlock);
+  return pe;
 }
 
+// unbind port, which must be bound to the entry want if want
+// isn't 0. returns -1 if it isn't bound (to want).
+static int
+port_unbind(uint16 port, struct port_entry *want)
+{
+  struct portbucket *b = port_bucket(port);
+  struct port_entry **pp, *pe;
+
+  acquire(&netlock);
+  acquire(&b->lock);
+
+  for(pp = &b->head; (pe = *pp) != 0; pp = &pe->next)
+    if(pe->port == port)
+      break;
+
+  if(!pe || (want && pe != want)) {
+    release(&b->lock);
+    release(&netlock);
+    return -1;
+  }
+  *pp = pe->next;
+
+  // Once the port lock is held, no one still holds a pointer to
+  // pe that they found without taking a reference.
+  acquire(&pe->lock);
+  release(&b->lock);
+  release(&netlock);
+
+  pe->bound = 0;
+
+  // Drop anything still queued.
+  while(pe->count > 0) {
+    packet_free(&pe->queue[pe->head]);
+    pe->head = (pe->head + 1) % QUEUESIZE;
+    pe->count--;
+  }
+
+  // Anyone sleeping in recv() will see that the port is gone,
+  // and the last of them frees the entry.
+  pe->ref++;
+  wakeup(pe);
+  pollwake(&pe->ph, POLLHUP);
+  port_put(pe);
+
+  return 0;
+}
 
 //
 // bind(int port)
@@ -73,34 +346,14 @@ sys_bind(void)
   if(port_arg < 0 || port_arg > 65535)
     return -1;
 
-  uint16 port = (uint16)port_arg;
-
-  acquire(&netlock);
-
-  // Check if port is already bound
-  for(int i = 0; i < NPORTS; i++) {
-    if(ports[i].bound && ports[i].port == port) {
-      release(&netlock);
-      return 0;
-    }
-  }
-
-  // Find a free port entry
-  for(int i = 0; i < NPORTS; i++) {
-    if(!ports[i].bound) {
-      ports[i].bound = 1;
-      ports[i].port = port;
-      ports[i].head = 0;
-      ports[i].tail = 0;
-      ports[i].count = 0;
-      ports[i].drops = 0;
-      release(&netlock);
-      return 0;
-    }
-  }
+  struct port_entry *pe = port_bind((uint16)port_arg, 0);
+  if(!pe)
+    return -1;
 
-  release(&netlock);
-  return -1;
+  // the port stays bound until unbind(); nothing holds on to pe.
+  acquire(&pe->lock);
+  port_put(pe);
+  return 0;
 }
 
 //
@@ -111,10 +364,56 @@ sys_bind(void)
 uint64
 sys_unbind(void)
 {
-  //
-  // Optional: Your code here.
-  //
+  int port_arg;
+  argint(0, &port_arg);
 
+  if(port_arg < 0 || port_arg > 65535)
+    return -1;
+
+  return port_unbind((uint16)port_arg, 0);
+}
+
+// take the packet at the head of pe's queue into *pkt, noting
+// how long it was queued. the slot can be reused as soon as
+// the port lock is released, hence the copy.
+// caller must hold pe->lock.
+static void
+port_take(struct port_entry *pe, struct packet *pkt)
+{
+  *pkt = pe->queue[pe->head];
+  pe->head = (pe->head + 1) % QUEUESIZE;
+  pe->count--;
+  pkt->stamp[RXSTAMP_DEQ] = r_time();
+  rxlat_add(pkt->woke ? RXLAT_WAKE : RXLAT_QUEUE,
+            pkt->stamp[RXSTAMP_ENQ], pkt->stamp[RXSTAMP_DEQ]);
+}
+
+// wait for a packet to arrive on pe and dequeue it into *pkt.
+// with nonblock, don't wait; otherwise, if deadline isn't 0,
+// wait only until then (see timedsleep()).
+// returns -1 if there's no packet because of that, or because
+// the port is unbound or the caller is killed while waiting.
+// caller must hold pe->lock.
+static int
+port_dequeue(struct port_entry *pe, struct packet *pkt, int nonblock, uint64 deadline)
+{
+  int timedout = 0;
+
+  while(pe->count == 0 && pe->bound && !nonblock && !killed(myproc()) && !timedout) {
+    pe->nwait++;
+    if(deadline == 0)
+      sleep(pe, &pe->lock);
+    else
+      timedout = timedsleep(pe, &pe->lock, deadline);
+    pe->nwait--;
+  }
+
+  if(pe->count == 0) {
+    // unbound, killed, timed out, or didn't wait
+    return -1;
+  }
+
+  port_take(pe, pkt);
   return 0;
 }
 
@@ -154,50 +453,140 @@ sys_recv(void)
   uint16 port = (uint16)port_arg;
   struct proc *p = myproc();
 
-  acquire(&netlock);
-
   // Find the port entry
-  struct port_entry *pe = 0;
-  for(int i = 0; i < NPORTS; i++) {
-    if(ports[i].bound && ports[i].port == port) {
-      pe = &ports[i];
-      break;
-    }
-  }
+  struct port_entry *pe = port_get(port);
+  if(!pe)
+    return -1;
 
-  if(!pe) {
-    release(&netlock);
+  struct packet pkt;
+  if(port_dequeue(pe, &pkt, 0, 0) < 0) {
+    port_put(pe);
     return -1;
   }
 
-  // Wait for a packet if queue is empty
-  while(pe->count == 0) {
-    sleep(pe, &netlock);
-  }
+  port_put(pe);
 
-  // Dequeue a packet
-  struct packet *pkt = &pe->queue[pe->head];
-  pe->head = (pe->head + 1) % QUEUESIZE;
-  pe->count--;
+  // The only copy of the payload: e1000 buffer to user space.
+  int r = packet_copyout(&pkt, buf_addr, maxlen);
+  if(copyout(p->pagetable, src_addr, (char*)&pkt.src_ip, sizeof(pkt.src_ip)) < 0 ||
+     copyout(p->pagetable, sport_addr, (char*)&pkt.src_port, sizeof(pkt.src_port)) < 0)
+    r = -1;
 
-  // Copy packet data
-  uint32 src_ip = pkt->src_ip;
-  uint16 src_port = pkt->src_port;
-  int copy_len = pkt->len < maxlen ? pkt->len : maxlen;
+  packet_free(&pkt);
 
-  release(&netlock);
+  return r;
+}
 
-  // Copy data to user space
-  if(copyout(p->pagetable, buf_addr, pkt->data, copy_len) < 0)
-    return -1;
+//
+// recvmmsg(int dport, struct udpmsg *msgs, int n, int min, int flags, int timeout)
+// receive up to n datagrams addressed to dport with a single
+// system call. waits until at least min datagrams have been
+// received (1 if min <= 0), then takes whatever else is already
+// queued without waiting. with MSG_DONTWAIT, never waits, and
+// returns only what was queued at the time of the call.
+// waits no longer than timeout milliseconds, unless timeout is -1,
+// and then returns whatever it has.
+//
+// for each datagram, copies up to msgs[i].len bytes of payload
+// to msgs[i].buf and sets msgs[i].len, .addr and .port.
+// returns the number of datagrams received,
+// and -1 if there was an error.
+//
+uint64
+sys_recvmmsg(void)
+{
+  int port_arg;
+  uint64 msgs_addr;
+  int n;
+  int min;
+  int flags;
+  int timeout;
 
-  if(copyout(p->pagetable, src_addr, (char*)&src_ip, sizeof(src_ip)) < 0)
+  argint(0, &port_arg);
+  argaddr(1, &msgs_addr);
+  argint(2, &n);
+  argint(3, &min);
+  argint(4, &flags);
+  argint(5, &timeout);
+
+  if(port_arg < 0 || port_arg > 65535 || n <= 0 || timeout < -1)
     return -1;
+  if(min <= 0)
+    min = 1;
+  if(min > n)
+    min = n;
+  if(flags & MSG_DONTWAIT)
+    min = 0;
 
-  if(copyout(p->pagetable, sport_addr, (char*)&src_port, sizeof(src_port)) < 0)
+  uint16 port = (uint16)port_arg;
+  struct proc *p = myproc();
+  struct packet batch[QUEUESIZE];
+  int got = 0;
+  uint64 deadline = timeout >= 0 ? timer_deadline(timeout) : 0;
+  int timedout = 0;
+
+  struct port_entry *pe = port_get(port);
+  if(!pe)
     return -1;
 
-  return copy_len;
+  while(got < n) {
+    if(pe->count == 0) {
+      if(got >= min || !pe->bound || killed(p) || timedout)
+        break;
+      pe->nwait++;
+      if(deadline == 0)
+        sleep(pe, &pe->lock);
+      else
+        timedout = timedsleep(pe, &pe->lock, deadline);
+      pe->nwait--;
+      continue;
+    }
+
+    // Take everything that's queued (up to what the caller
+    // asked for) under one acquisition of the port lock, then
+    // copy the batch out without holding it.
+    int nb = 0;
+    while(pe->count > 0 && got + nb < n)
+      port_take(pe, &batch[nb++]);
+
+    release(&pe->lock);
+
+    int err = 0;
+    for(int i = 0; i < nb; i++) {
+      uint64 ma = msgs_addr + (got + i) * sizeof(struct udpmsg);
+      struct udpmsg m;
+      if(!err && copyin(p->pagetable, (char*)&m, ma, sizeof(m)) == 0) {
+        if(m.len > batch[i].len)
+          m.len = batch[i].len;
+        if(m.len < 0)
+          m.len = 0;
+        m.addr = batch[i].src_ip;
+        m.port = batch[i].src_port;
+        for(int j = 0; j < NRXSTAMP; j++)
+          m.stamp[j] = timer_ns(batch[i].stamp[j]);
+        if(packet_copyout(&batch[i], m.buf, m.len) < 0 ||
+           copyout(p->pagetable, ma, (char*)&m, sizeof(m)) < 0)
+          err = 1;
+      } else {
+        err = 1;
+      }
+      packet_free(&batch[i]);
+    }
+
+    acquire(&pe->lock);
+
+    if(err) {
+      got = -1;
+      break;
+    }
+    got += nb;
+  }
+
+  port_put(pe);
+
+  if(got == 0 && !(flags & MSG_DONTWAIT) && !timedout)
+    return -1;  // unbound or killed while waiting
+  return got;
 }
 
 // This code is lifted from FreeBSD's ping.c, and is copyright by the Regents
@@ -235,38 +624,29 @@ in_cksum(const unsigned char *addr, int len)
   return answer;
 }
 
-//
-// send(int sport, int dst, int dport, char *buf, int len)
-//
-uint64
-sys_send(void)
+// The UDP checksum covers a pseudo-header of the IP addresses,
+// protocol and UDP length as well as the UDP header and payload.
+// The e1000 only sums the UDP part, so the UDP checksum field is
+// seeded with the (uncomplemented) pseudo-header sum; adding it
+// in yields the real checksum. addresses are host byte order.
+static uint16
+udp_pseudo_sum(uint32 src, uint32 dst, uint16 ulen)
 {
-  struct proc *p = myproc();
-  int sport;
-  int dst;
-  int dport;
-  uint64 bufaddr;
-  int len;
-
-  argint(0, &sport);
-  argint(1, &dst);
-  argint(2, &dport);
-  argaddr(3, &bufaddr);
-  argint(4, &len);
-
-  int total = len + sizeof(struct eth) + sizeof(struct ip) + sizeof(struct udp);
-  if(total > PGSIZE)
-    return -1;
-
-  char *buf = kalloc();
-  if(buf == 0){
-    printf("sys_send: kalloc failed\n");
-    return -1;
-  }
-  memset(buf, 0, PGSIZE);
+  uint32 sum = (src >> 16) + (src & 0xffff) +
+               (dst >> 16) + (dst & 0xffff) +
+               IPPROTO_UDP + ulen;
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum += (sum >> 16);
+  return htons(sum);
+}
 
+// Fill in the Ethernet, IP and UDP headers at the start of buf
+// for a datagram with len bytes of payload, all but the Ethernet
+// destination, which is up to ARP.
+static void
+udp_header(char *buf, uint16 sport, uint32 dst, uint16 dport, int len)
+{
   struct eth *eth = (struct eth *) buf;
-  memmove(eth->dhost, host_mac, ETHADDR_LEN);
   memmove(eth->shost, local_mac, ETHADDR_LEN);
   eth->type = htons(ETHTYPE_IP);
 
@@ -280,166 +660,825 @@ sys_send(void)
   ip->ip_p = IPPROTO_UDP;
   ip->ip_src = htonl(local_ip);
   ip->ip_dst = htonl(dst);
-  ip->ip_sum = in_cksum((unsigned char *)ip, sizeof(*ip));
+  ip->ip_sum = 0;  // filled in by the e1000
 
   struct udp *udp = (struct udp *)(ip + 1);
   udp->sport = htons(sport);
   udp->dport = htons(dport);
   udp->ulen = htons(len + sizeof(struct udp));
+  udp->sum = udp_pseudo_sum(local_ip, dst, len + sizeof(struct udp));
+}
+
+// the most payload a datagram can carry, in one frame or at all.
+#define UDP_MAXFRAME (IP_MTU - sizeof(struct ip) - sizeof(struct udp))
+#define UDP_MAXLEN   (0xffff - sizeof(struct ip) - sizeof(struct udp))
+
+// Build an Ethernet/IP/UDP frame in a fresh packet buffer, copying len
+// bytes of payload in from user address bufaddr. Returns the
+// frame and sets *total to its length, or returns 0 on error.
+static char *
+udp_build(uint16 sport, uint32 dst, uint16 dport, uint64 bufaddr, int len, int *total)
+{
+  struct proc *p = myproc();
 
-  char *payload = (char *)(udp + 1);
+  *total = len + sizeof(struct eth) + sizeof(struct ip) + sizeof(struct udp);
+  if(len < 0 || len > UDP_MAXFRAME)
+    return 0;
+
+  char *buf = pbuf_alloc();
+  if(buf == 0){
+    printf("sys_send: pbuf_alloc failed\n");
+    return 0;
+  }
+
+  udp_header(buf, sport, dst, dport, len);
+
+  char *payload = buf + sizeof(struct eth) + sizeof(struct ip) + sizeof(struct udp);
   if(copyin(p->pagetable, payload, bufaddr, len) < 0){
-    kfree(buf);
+    pbuf_free(buf);
     printf("send: copyin failed\n");
+    return 0;
+  }
+
+  return buf;
+}
+
+// payloads at least this long are sent straight from the
+// sender's pages; for shorter ones the copy is cheaper than the
+// extra descriptors and the wait for completion. only datagrams
+// that fit in one frame (up to UDP_MAXFRAME) are sent this way;
+// udp_send_frags() still copies each fragment.
+#define SEND_ZEROCOPY_MIN 1024
+
+// Send a datagram without copying the payload: the headers go
+// in one descriptor and the payload in one per user page it
+// touches, pointing at the page itself. The user pages aren't
+// pinned; they stay put only because the sender, waiting in
+// e1000_transmit_sg(), can't run (and so can't unmap them or
+// exit) until the e1000 is done with them.
+// Returns 0 if sent, -1 on error, or 1 if the payload isn't
+// resident or the next hop's address isn't known yet, and the
+// caller should fall back to copying.
+static int
+udp_send_zerocopy(uint16 sport, uint32 dst, uint16 dport, uint64 bufaddr, int len)
+{
+  struct proc *p = myproc();
+  char hdr[sizeof(struct eth) + sizeof(struct ip) + sizeof(struct udp)];
+  uint64 segs[2];
+  int seglens[2];
+  int nseg = 0;
+
+  if(len > UDP_MAXFRAME)
     return -1;
+
+  // less than a page can't span more than two pages.
+  for(uint64 va = bufaddr; va < bufaddr + len; nseg++){
+    uint64 va0 = PGROUNDDOWN(va);
+    uint64 pa0 = walkaddr(p->pagetable, va0);
+    if(pa0 == 0)
+      return 1;
+    uint64 n = PGSIZE - (va - va0);
+    if(n > bufaddr + len - va)
+      n = bufaddr + len - va;
+    segs[nseg] = pa0 + (va - va0);
+    seglens[nseg] = n;
+    va += n;
   }
 
-  e1000_transmit(buf, total);
+  udp_header(hdr, sport, dst, dport, len);
+  if(!arp_lookup(dst, ((struct eth *)hdr)->dhost))
+    return 1;
+  return e1000_transmit_sg(hdr, sizeof(hdr), segs, seglens, nseg,
+                           E1000_TX_WAIT | E1000_TX_CSUM);
+}
+
+// the IP identification of the next datagram sent in fragments,
+// in its low 16 bits. a uint32, since not every compiler can do
+// a 16-bit atomic add without libgcc.
+static uint32 ip_id;
+
+// data in each fragment but the last, a multiple of 8 bytes; and
+// so the most fragments a datagram takes.
+#define FRAG_MAXDATA ((IP_MTU - sizeof(struct ip)) & ~7)
+#define FRAG_MAX     ((UDP_MAXLEN + sizeof(struct udp) + FRAG_MAXDATA - 1) / FRAG_MAXDATA)
+
+// Send a datagram too big for one frame as IP fragments, each
+// copied into its own packet buffer and queued on the e1000
+// with a single doorbell. The e1000 would compute the UDP
+// checksum of each fragment separately, so it's done here over
+// the whole datagram as the payload is copied in; the IP header
+// checksums are cheap to do here too.
+// Returns 0 or -1.
+static int
+udp_send_frags(uint16 sport, uint32 dst, uint16 dport, uint64 bufaddr, int len)
+{
+  struct proc *p = myproc();
+  int ulen = len + sizeof(struct udp);
+  int maxdata = FRAG_MAXDATA;
+  char *bufs[FRAG_MAX];
+  int lens[FRAG_MAX];
+  int nfrag = 0;
+  uint8 mac[ETHADDR_LEN];
+
+  if(len > UDP_MAXLEN)
+    return -1;
+
+  // ARP doesn't hold enough frames for a whole datagram,
+  // so wait for the address now.
+  if(arp_resolve(dst, mac) < 0)
+    return -1;
+
+  uint16 id = (uint16)__sync_fetch_and_add(&ip_id, 1);
+  uint32 sum = udp_pseudo_sum(local_ip, dst, ulen);
+  struct udp *udp = 0;
+
+  for(int off = 0; off < ulen; off += maxdata){
+    int n = ulen - off < maxdata ? ulen - off : maxdata;
+    char *buf = pbuf_alloc();
+    if(buf == 0)
+      goto bad;
+    bufs[nfrag] = buf;
+    lens[nfrag] = sizeof(struct eth) + sizeof(struct ip) + n;
+    nfrag++;
+
+    struct eth *eth = (struct eth *) buf;
+    memmove(eth->dhost, mac, ETHADDR_LEN);
+    memmove(eth->shost, local_mac, ETHADDR_LEN);
+    eth->type = htons(ETHTYPE_IP);
+
+    struct ip *ip = (struct ip *)(eth + 1);
+    ip->ip_vhl = 0x45;
+    ip->ip_tos = 0;
+    ip->ip_len = htons(sizeof(struct ip) + n);
+    ip->ip_id = htons(id);
+    ip->ip_off = htons((off >> 3) | (off + n < ulen ? IP_MF : 0));
+    ip->ip_ttl = 100;
+    ip->ip_p = IPPROTO_UDP;
+    ip->ip_src = htonl(local_ip);
+    ip->ip_dst = htonl(dst);
+    ip->ip_sum = 0;
+    ip->ip_sum = in_cksum((unsigned char *)ip, sizeof(struct ip));
+
+    // the first fragment's data starts with the UDP header.
+    char *data = (char *)(ip + 1);
+    if(off == 0){
+      udp = (struct udp *) data;
+      udp->sport = htons(sport);
+      udp->dport = htons(dport);
+      udp->ulen = htons(ulen);
+      udp->sum = 0;
+      if(copyin(p->pagetable, (char *)(udp + 1), bufaddr, n - sizeof(struct udp)) < 0)
+        goto bad;
+    } else {
+      if(copyin(p->pagetable, data, bufaddr + off - sizeof(struct udp), n) < 0)
+        goto bad;
+    }
+    // maxdata is a multiple of 8, so only the last piece
+    // can be odd.
+    sum += (uint16)~in_cksum((unsigned char *)data, n);
+  }
+
+  while(sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  uint16 c = ~sum;
+  udp->sum = c ? c : 0xffff;  // 0 would mean no checksum
+
+  int nq = e1000_transmitv(bufs, lens, nfrag, E1000_TX_WAIT);
+  for(int i = nq; i < nfrag; i++)
+    pbuf_free(bufs[i]);
+  return nq == nfrag ? 0 : -1;
+
+ bad:
+  for(int i = 0; i < nfrag; i++)
+    pbuf_free(bufs[i]);
+  return -1;
+}
+
+// send a datagram with len bytes of payload from user address
+// bufaddr. returns 0 or -1.
+static int
+udp_send(uint16 sport, uint32 dst, uint16 dport, uint64 bufaddr, int len)
+{
+  int total;
+
+  if(len > UDP_MAXFRAME)
+    return udp_send_frags(sport, dst, dport, bufaddr, len);
+
+  if(len >= SEND_ZEROCOPY_MIN){
+    int r = udp_send_zerocopy(sport, dst, dport, bufaddr, len);
+    if(r <= 0)
+      return r;
+  }
+
+  char *buf = udp_build(sport, dst, dport, bufaddr, len, &total);
+  if(buf == 0)
+    return -1;
+
+  // if the next hop has to be asked for its address, ARP
+  // holds on to the datagram and sends it once it answers.
+  int r = arp_fill(buf, total, dst, E1000_TX_CSUM);
+  if(r <= 0){
+    if(r < 0)
+      pbuf_free(buf);
+    return r;
+  }
+
+  // Waits for room in the transmit ring, so a fast sender
+  // is held back to the rate the e1000 can actually send.
+  if(e1000_transmit(buf, total, E1000_TX_WAIT | E1000_TX_CSUM) < 0){
+    pbuf_free(buf);
+    return -1;
+  }
 
   return 0;
 }
 
+//
+// send(int sport, int dst, int dport, char *buf, int len)
+//
+uint64
+sys_send(void)
+{
+  int sport;
+  int dst;
+  int dport;
+  uint64 bufaddr;
+  int len;
+
+  argint(0, &sport);
+  argint(1, &dst);
+  argint(2, &dport);
+  argaddr(3, &bufaddr);
+  argint(4, &len);
+
+  return udp_send(sport, dst, dport, bufaddr, len);
+}
+
+// datagrams built and handed to the e1000 per doorbell.
+#define TXBATCH 16
+
+//
+// sendmmsg(int sport, struct udpmsg *msgs, int n)
+// send n datagrams from sport, to msgs[i].addr and msgs[i].port,
+// with msgs[i].len bytes of payload from msgs[i].buf.
+// the datagrams are queued on the e1000 in batches, with one
+// tail doorbell per batch, waiting for room in the ring if need be.
+// a datagram whose next hop has to be asked for its address
+// counts as queued once ARP is holding it; one too big for a
+// frame is sent as IP fragments.
+//
+// sets msgs[i].err to 0 for each datagram that was queued and
+// to -1 for each that wasn't (e.g. because it was malformed, the
+// neighbor cache was full, or the caller was killed while waiting
+// for the ring).
+// returns the number of datagrams queued, which are always
+// msgs[0] through msgs[r-1], or -1 if there was an error.
+//
+uint64
+sys_sendmmsg(void)
+{
+  struct proc *p = myproc();
+  int sport;
+  uint64 msgs_addr;
+  int n;
+
+  argint(0, &sport);
+  argaddr(1, &msgs_addr);
+  argint(2, &n);
+
+  if(n < 0)
+    return -1;
+
+  struct udpmsg m[TXBATCH];
+  char *bufs[TXBATCH];
+  int lens[TXBATCH];
+  int sent = 0;
+  int stop = 0;
+
+  for(int base = 0; base < n; base += TXBATCH){
+    int nb = n - base < TXBATCH ? n - base : TXBATCH;
+    uint64 ma = msgs_addr + base * sizeof(struct udpmsg);
+
+    if(copyin(p->pagetable, (char*)m, ma, nb * sizeof(struct udpmsg)) < 0)
+      return -1;
+
+    int i = 0;
+    while(!stop && i < nb){
+      // Build the frames that fit in one and whose next hop's
+      // address is known; stop at the first one that can't be
+      // built, so that the queued datagrams stay a prefix of
+      // msgs, or that needs fragmenting or ARP, which is sent
+      // the slow way once those before it are on the ring.
+      int nbuilt = 0;
+      int slow = 0;
+      while(i + nbuilt < nb){
+        struct udpmsg *mp = &m[i + nbuilt];
+        if(mp->len > UDP_MAXFRAME){
+          slow = 1;
+          break;
+        }
+        bufs[nbuilt] = udp_build(sport, mp->addr, mp->port,
+                                 mp->buf, mp->len, &lens[nbuilt]);
+        if(bufs[nbuilt] == 0){
+          stop = 1;
+          break;
+        }
+        if(!arp_lookup(mp->addr, ((struct eth *)bufs[nbuilt])->dhost)){
+          pbuf_free(bufs[nbuilt]);
+          slow = 1;
+          break;
+        }
+        nbuilt++;
+      }
+
+      int nq = e1000_transmitv(bufs, lens, nbuilt,
+                               E1000_TX_WAIT | E1000_TX_CSUM);
+      for(int j = nq; j < nbuilt; j++)
+        pbuf_free(bufs[j]);
+      i += nq;
+      if(nq < nbuilt){
+        stop = 1;
+        break;
+      }
+
+      if(slow){
+        if(udp_send(sport, m[i].addr, m[i].port, m[i].buf, m[i].len) < 0){
+          stop = 1;
+          break;
+        }
+        i++;
+      }
+    }
+
+    for(int j = 0; j < nb; j++)
+      m[j].err = j < i ? 0 : -1;
+    if(copyout(p->pagetable, ma, (char*)m, nb * sizeof(struct udpmsg)) < 0)
+      return -1;
+
+    sent += i;
+  }
+
+  return sent;
+}
+
+//
+// UDP sockets: a file descriptor for a bound port, created by
+// socket(). read() receives a datagram, write() sends one to
+// the socket's peer, and the port is unbound when the last
+// descriptor referring to it is closed.
+//
+struct sock {
+  struct port_entry *pe;  // bound port, with a reference held
+  uint16 lport;
+  uint32 raddr;           // peer, host byte order
+  uint16 rport;           // 0 if none; write() then fails
+  int rcvtimeo;           // read() waits at most this many ms, if not 0
+  int nonblock;           // read() doesn't wait at all
+  struct sock *next;      // on the free list
+};
+
+static struct sock *
+sock_alloc(void)
+{
+  struct sock *so;
+
+  acquire(&sock_lock);
+  if(sock_freelist == 0){
+    char *page = kalloc();
+    if(page == 0){
+      release(&sock_lock);
+      return 0;
+    }
+    for(so = (struct sock *)page; (char*)(so + 1) <= page + PGSIZE; so++){
+      so->next = sock_freelist;
+      sock_freelist = so;
+    }
+  }
+  so = sock_freelist;
+  sock_freelist = so->next;
+  release(&sock_lock);
+
+  memset(so, 0, sizeof(*so));
+  return so;
+}
+
+static void
+sock_free(struct sock *so)
+{
+  acquire(&sock_lock);
+  so->next = sock_freelist;
+  sock_freelist = so;
+  release(&sock_lock);
+}
+
+// create a socket for lport, which mustn't already be bound.
+// raddr and rport are the destination of write()s.
+int
+sockalloc(struct file **f, uint16 lport, uint32 raddr, uint16 rport)
+{
+  struct sock *so;
+
+  so = 0;
+  *f = 0;
+  if((*f = filealloc()) == 0)
+    goto bad;
+  if((so = sock_alloc()) == 0)
+    goto bad;
+  if((so->pe = port_bind(lport, 1)) == 0)
+    goto bad;
+  so->lport = lport;
+  so->raddr = raddr;
+  so->rport = rport;
+  so->rcvtimeo = 0;
+  so->nonblock = 0;
+  (*f)->type = FD_SOCK;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->sock = so;
+  return 0;
+
+ bad:
+  if(so)
+    sock_free(so);
+  if(*f)
+    fileclose(*f);
+  return -1;
+}
+
 void
-ip_rx(char *buf, int len)
+sockclose(struct sock *so)
 {
-  // don't delete this printf; make grade depends on it.
-  static int seen_ip = 0;
-  if(seen_ip == 0)
-    printf("ip_rx: received an IP packet\n");
-  seen_ip = 1;
+  // the port may already have been unbound, and perhaps bound
+  // again by someone else, with unbind(); leave it alone then.
+  port_unbind(so->lport, so->pe);
+  acquire(&so->pe->lock);
+  port_put(so->pe);
+  sock_free(so);
+}
 
-  // Parse Ethernet header
-  struct eth *eth_hdr = (struct eth *)buf;
+// receive one datagram, copying up to n bytes of its payload
+// to user address addr. returns the number of bytes copied.
+int
+sockread(struct sock *so, uint64 addr, int n)
+{
+  struct packet pkt;
+  int r;
 
-  struct ip *ip_hdr = (struct ip *)(eth_hdr + 1);
+  if(n < 0)
+    return -1;
 
-  if(ip_hdr->ip_p != IPPROTO_UDP) {
-    kfree(buf);
-    return;
+  uint64 deadline = so->rcvtimeo ? timer_deadline(so->rcvtimeo) : 0;
+  acquire(&so->pe->lock);
+  r = port_dequeue(so->pe, &pkt, so->nonblock, deadline);
+  release(&so->pe->lock);
+  if(r < 0)
+    return -1;
+
+  r = packet_copyout(&pkt, addr, n);
+  packet_free(&pkt);
+  return r;
+}
+
+// send the n bytes at user address addr as one datagram
+// to the socket's peer.
+int
+sockwrite(struct sock *so, uint64 addr, int n)
+{
+  if(so->rport == 0)
+    return -1;
+  if(udp_send(so->lport, so->raddr, so->rport, addr, n) < 0)
+    return -1;
+  return n;
+}
+
+// set a socket option; see sockopt() in net.h.
+int
+sockopt(struct sock *so, int opt, int val)
+{
+  switch(opt){
+  case SO_RCVTIMEO:
+    if(val < 0)
+      return -1;
+    so->rcvtimeo = val;
+    return 0;
+  case SO_NONBLOCK:
+    so->nonblock = val != 0;
+    return 0;
   }
+  return -1;
+}
 
-  struct udp *udp_hdr = (struct udp *)(ip_hdr + 1);
+// the poll() state of a socket. writes never have to wait
+// for long, so a socket with a peer is always writable.
+int
+sockpoll(struct sock *so, struct pollentry *e)
+{
+  struct port_entry *pe = so->pe;
+  int r = 0;
+
+  acquire(&pe->lock);
+  if(pe->count > 0)
+    r |= POLLIN;
+  if(!pe->bound)
+    r |= POLLHUP;
+  else if(so->rport != 0)
+    r |= POLLOUT;
+  if(e)
+    pollregister(&pe->ph, &pe->lock, e);
+  release(&pe->lock);
+  return r;
+}
 
-  uint16 dport = ntohs(udp_hdr->dport);
-  uint16 sport = ntohs(udp_hdr->sport);
-  uint32 src_ip = ntohl(ip_hdr->ip_src);
-  uint16 udp_len = ntohs(udp_hdr->ulen);
+// Check the IP header checksum, and the UDP checksum if the
+// sender supplied one, of a received datagram. csum says which
+// of them the e1000 has already checked (NET_RX_* flags); only
+// the others are computed in software, so with offload enabled
+// the payload is never touched here.
+static int
+ip_csum_ok(struct ip *ip, struct udp *udp, int csum)
+{
+  if(csum & NET_RX_IP_BAD)
+    return 0;
+  if(!(csum & NET_RX_IP_OK) &&
+     in_cksum((unsigned char *)ip, (ip->ip_vhl & 0xf) * 4) != 0)
+    return 0;
+
+  if(udp->sum == 0)
+    return 1;  // sender didn't compute a UDP checksum
+  if(csum & NET_RX_UDP_BAD)
+    return 0;
+  if(!(csum & NET_RX_UDP_OK)){
+    uint16 ulen = ntohs(udp->ulen);
+    uint32 sum = (uint16)~in_cksum((unsigned char *)udp, ulen) +
+      udp_pseudo_sum(ntohl(ip->ip_src), ntohl(ip->ip_dst), ulen);
+    sum = (sum & 0xffff) + (sum >> 16);
+    if(sum != 0xffff)
+      return 0;
+  }
+  return 1;
+}
 
-  // Calculate payload length (UDP length includes UDP header)
-  int payload_len = udp_len - sizeof(struct udp);
-  if(payload_len < 0 || payload_len > 2048) {
-    kfree(buf);
+//
+// answer an ICMP echo request (ping) in place: turn the received
+// frame around and hand it straight back to the e1000, without
+// waking anyone up, so the round trip measures just the wire, the
+// driver and the interrupt path.
+//
+static void
+icmp_rx(char *buf, int len, int csum)
+{
+  struct eth *eth = (struct eth *) buf;
+  struct ip *ip = (struct ip *)(eth + 1);
+  int hlen = (ip->ip_vhl & 0xf) * 4;
+  int iplen = ntohs(ip->ip_len);
+  struct icmp_echo *icmp = (struct icmp_echo *)((char *)ip + hlen);
+
+  if(hlen < sizeof(struct ip) || iplen < hlen + sizeof(*icmp) ||
+     sizeof(*eth) + iplen > len ||
+     ntohl(ip->ip_dst) != local_ip){
+    NETSTAT_INC(rx_short);
+    pbuf_free(buf);
+    return;
+  }
+  if(icmp->type != ICMP_ECHO || icmp->code != 0){
+    NETSTAT_INC(rx_proto);
+    pbuf_free(buf);
+    return;
+  }
+  if((csum & NET_RX_IP_BAD) ||
+     (!(csum & NET_RX_IP_OK) && in_cksum((unsigned char *)ip, hlen) != 0)){
+    NETSTAT_INC(rx_csum);
+    pbuf_free(buf);
     return;
   }
 
-  // Payload starts after UDP header
-  char *payload = (char *)(udp_hdr + 1);
+  uint8 mac[ETHADDR_LEN];
+  memmove(mac, eth->shost, ETHADDR_LEN);
+  memmove(eth->dhost, mac, ETHADDR_LEN);
+  memmove(eth->shost, local_mac, ETHADDR_LEN);
 
-  acquire(&netlock);
+  uint32 src = ip->ip_src;
+  ip->ip_src = ip->ip_dst;
+  ip->ip_dst = src;
+  ip->ip_ttl = 64;
+  ip->ip_sum = 0;
+  ip->ip_sum = in_cksum((unsigned char *)ip, hlen);
+
+  // only the type changes, so update the checksum for that
+  // (RFC 1624) rather than summing the data. the data isn't
+  // checked either: if it was damaged, the reply's checksum is
+  // still wrong, and the sender will notice.
+  uint32 sum = (uint16)~ntohs(icmp->sum) + (uint16)~(ICMP_ECHO << 8) +
+    (ICMP_ECHOREPLY << 8);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum += (sum >> 16);
+  icmp->type = ICMP_ECHOREPLY;
+  icmp->sum = htons(~sum);
+
+  // called from the receive path, so don't wait for room.
+  if(e1000_transmit(buf, sizeof(*eth) + iplen, 0) < 0)
+    pbuf_free(buf);
+  else
+    NETSTAT_INC(icmp_echo);
+}
 
-  // Find the port entry
-  struct port_entry *pe = 0;
-  for(int i = 0; i < NPORTS; i++) {
-    if(ports[i].bound && ports[i].port == dport) {
-      pe = &ports[i];
-      break;
-    }
-  }
+// queue a received datagram, with len bytes of payload at
+// payload, on port dport; the queue now owns buf. frags says
+// whether buf is a chain of fragments (see struct packet).
+// stamp is when the e1000 driver took it off the ring.
+static void
+udp_deliver(char *buf, int frags, char *payload, int len,
+            uint32 src_ip, uint16 sport, uint16 dport, uint64 stamp)
+{
+  // Find the port entry; this locks it.
+  struct port_entry *pe = port_lookup(dport);
+  struct packet pkt = { buf, payload, len, frags, src_ip, sport };
 
   // If port not bound, drop the packet
   if(!pe) {
-    release(&netlock);
-    kfree(buf);
+    NETSTAT_INC(rx_noport);
+    packet_free(&pkt);
     return;
   }
 
   // If queue is full, drop the packet
   if(pe->count >= QUEUESIZE) {
     pe->drops++;  // Track the drop
-    release(&netlock);
-    kfree(buf);
+    release(&pe->lock);
+    NETSTAT_INC(rx_qfull);
+    packet_free(&pkt);
     return;
   }
 
-  // Enqueue the packet
-  struct packet *pkt = &pe->queue[pe->tail];
-  memmove(pkt->data, payload, payload_len);
-  pkt->len = payload_len;
-  pkt->src_ip = src_ip;
-  pkt->src_port = sport;
-
+  // Enqueue the packet.
+  pkt.woke = pe->nwait > 0;
+  pkt.stamp[RXSTAMP_NIC] = stamp;
+  pkt.stamp[RXSTAMP_ENQ] = r_time();
+  rxlat_add(RXLAT_STACK, stamp, pkt.stamp[RXSTAMP_ENQ]);
+  pe->queue[pe->tail] = pkt;
   pe->tail = (pe->tail + 1) % QUEUESIZE;
   pe->count++;
+  pe->rx++;
+  if(pe->count > pe->hiwat)
+    pe->hiwat = pe->count;
+  NETSTAT_INC(rx_delivered);
 
   // Wake up any process waiting for packets on this port
   wakeup(pe);
+  pollwake(&pe->ph, POLLIN);
 
-  release(&netlock);
+  release(&pe->lock);
+}
 
-  // Free the buffer (we copied the data we need)
-  kfree(buf);
+// a fragment of a UDP datagram: hand it to reassembly, and
+// deliver the datagram once all of it has arrived. the e1000
+// can't check the UDP checksum of a fragmented datagram, so
+// it's done here, a fragment at a time. the datagram is stamped
+// with when its last fragment came in.
+static void
+udp_rx_frag(char *buf, int len, int csum, uint64 stamp)
+{
+  struct ip *ip = (struct ip *)(buf + sizeof(struct eth));
+  int hlen = (ip->ip_vhl & 0xf) * 4;
+
+  if(len < sizeof(struct eth) + hlen) {
+    NETSTAT_INC(rx_short);
+    pbuf_free(buf);
+    return;
+  }
+  if((csum & NET_RX_IP_BAD) ||
+     (!(csum & NET_RX_IP_OK) && in_cksum((unsigned char *)ip, hlen) != 0)) {
+    NETSTAT_INC(rx_csum);
+    pbuf_free(buf);
+    return;
+  }
+  uint32 src_ip = ntohl(ip->ip_src);
+  uint32 dst_ip = ntohl(ip->ip_dst);
+
+  int plen;
+  char *chain = ip_reass(buf, len, &plen);
+  if(chain == 0)
+    return;
+
+  struct ipfrag *f = (struct ipfrag *)chain;
+  struct udp *udp = (struct udp *)f->data;
+  if(ntohs(udp->ulen) != plen) {
+    NETSTAT_INC(rx_short);
+    ipfrag_free(chain);
+    return;
+  }
+  if(udp->sum != 0) {
+    // all but the last fragment hold a multiple of 8 bytes, so
+    // summing them separately keeps the 16-bit words aligned.
+    uint32 sum = udp_pseudo_sum(src_ip, dst_ip, plen);
+    for(char *b = chain; b; b = f->next) {
+      f = (struct ipfrag *)b;
+      sum += (uint16)~in_cksum((unsigned char *)f->data, f->len);
+    }
+    while(sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+    if(sum != 0xffff) {
+      NETSTAT_INC(rx_csum);
+      ipfrag_free(chain);
+      return;
+    }
+  }
+
+  udp_deliver(chain, 1, (char *)(udp + 1), plen - sizeof(struct udp),
+              src_ip, ntohs(udp->sport), ntohs(udp->dport), stamp);
 }
 
-//
-// send an ARP reply packet to tell qemu to map
-// xv6's ip address to its ethernet address.
-// this is the bare minimum needed to persuade
-// qemu to send IP packets to xv6; the real ARP
-// protocol is more complex.
-//
 void
-arp_rx(char *inbuf)
+ip_rx(char *buf, int len, int csum, uint64 stamp)
 {
-  static int seen_arp = 0;
+  // don't delete this printf; make grade depends on it.
+  static int seen_ip = 0;
+  if(seen_ip == 0)
+    printf("ip_rx: received an IP packet\n");
+  seen_ip = 1;
+
+  // Parse Ethernet header
+  struct eth *eth_hdr = (struct eth *)buf;
+
+  struct ip *ip_hdr = (struct ip *)(eth_hdr + 1);
+
+  // only UDP datagrams are reassembled.
+  int frag = (ip_hdr->ip_off & htons(IP_MF | IP_OFFMASK)) != 0;
 
-  if(seen_arp){
-    kfree(inbuf);
+  if(ip_hdr->ip_p == IPPROTO_ICMP && !frag) {
+    icmp_rx(buf, len, csum);
     return;
   }
-  printf("arp_rx: received an ARP packet\n");
-  seen_arp = 1;
 
-  struct eth *ineth = (struct eth *) inbuf;
-  struct arp *inarp = (struct arp *) (ineth + 1);
+  if(ip_hdr->ip_p != IPPROTO_UDP) {
+    NETSTAT_INC(rx_proto);
+    pbuf_free(buf);
+    return;
+  }
 
-  char *buf = kalloc();
-  if(buf == 0)
-    panic("send_arp_reply");
+  if(frag) {
+    udp_rx_frag(buf, len, csum, stamp);
+    return;
+  }
 
-  struct eth *eth = (struct eth *) buf;
-  memmove(eth->dhost, ineth->shost, ETHADDR_LEN); // ethernet destination = query source
-  memmove(eth->shost, local_mac, ETHADDR_LEN); // ethernet source = xv6's ethernet address
-  eth->type = htons(ETHTYPE_ARP);
+  struct udp *udp_hdr = (struct udp *)(ip_hdr + 1);
 
-  struct arp *arp = (struct arp *)(eth + 1);
-  arp->hrd = htons(ARP_HRD_ETHER);
-  arp->pro = htons(ETHTYPE_IP);
-  arp->hln = ETHADDR_LEN;
-  arp->pln = sizeof(uint32);
-  arp->op = htons(ARP_OP_REPLY);
+  uint16 dport = ntohs(udp_hdr->dport);
+  uint16 sport = ntohs(udp_hdr->sport);
+  uint32 src_ip = ntohl(ip_hdr->ip_src);
+  uint16 udp_len = ntohs(udp_hdr->ulen);
 
-  memmove(arp->sha, local_mac, ETHADDR_LEN);
-  arp->sip = htonl(local_ip);
-  memmove(arp->tha, ineth->shost, ETHADDR_LEN);
-  arp->tip = inarp->sip;
+  // Calculate payload length (UDP length includes UDP header)
+  int payload_len = udp_len - sizeof(struct udp);
+
+  // Payload starts after UDP header
+  char *payload = (char *)(udp_hdr + 1);
+
+  // The payload is handed to recv() in place, so it must lie
+  // entirely within the received frame.
+  if(len < sizeof(struct eth) + sizeof(struct ip) + sizeof(struct udp) ||
+     payload_len < 0 || payload + payload_len > buf + len) {
+    NETSTAT_INC(rx_short);
+    pbuf_free(buf);
+    return;
+  }
 
-  e1000_transmit(buf, sizeof(*eth) + sizeof(*arp));
+  // Drop corrupt datagrams.
+  if(!ip_csum_ok(ip_hdr, udp_hdr, csum)) {
+    NETSTAT_INC(rx_csum);
+    pbuf_free(buf);
+    return;
+  }
 
-  kfree(inbuf);
+  udp_deliver(buf, 0, payload, payload_len, src_ip, sport, dport, stamp);
 }
 
+//
+// called by the e1000 driver with each received frame.
+// csum holds NET_RX_* flags saying which checksums the
+// e1000 has verified (or found to be wrong), and stamp is the
+// r_time() when the driver took the frame off the ring.
+//
 void
-net_rx(char *buf, int len)
+net_rx(char *buf, int len, int csum, uint64 stamp)
 {
   struct eth *eth = (struct eth *) buf;
 
+  if(capture_on)
+    capture_tap(CAP_RX, buf, len, 0, 0, 0);
+
   if(len >= sizeof(struct eth) + sizeof(struct arp) &&
      ntohs(eth->type) == ETHTYPE_ARP){
     arp_rx(buf);
   } else if(len >= sizeof(struct eth) + sizeof(struct ip) &&
      ntohs(eth->type) == ETHTYPE_IP){
-    ip_rx(buf, len);
+    ip_rx(buf, len, csum, stamp);
   } else {
-    kfree(buf);
+    if(len >= sizeof(struct eth) && ntohs(eth->type) != ETHTYPE_ARP &&
+       ntohs(eth->type) != ETHTYPE_IP)
+      NETSTAT_INC(rx_proto);
+    else
+      NETSTAT_INC(rx_short);
+    pbuf_free(buf);
   }
 }
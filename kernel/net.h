@@ -53,6 +53,14 @@ struct ip {
   uint32 ip_src, ip_dst;
 };
 
+// ip_off flags and fragment offset, in 8-byte units.
+#define IP_DF      0x4000 // don't fragment
+#define IP_MF      0x2000 // more fragments follow
+#define IP_OFFMASK 0x1fff
+
+// largest IP datagram that fits in one Ethernet frame.
+#define IP_MTU 1500
+
 #define IPPROTO_ICMP 1  // Control message protocol
 #define IPPROTO_TCP  6  // Transmission control protocol
 #define IPPROTO_UDP  17 // User datagram protocol
@@ -69,6 +77,18 @@ struct udp {
   uint16 sum;   // checksum
 };
 
+// an ICMP echo request or reply (comes after an IP header).
+struct icmp_echo {
+  uint8  type;
+  uint8  code;
+  uint16 sum;   // checksum, covers the ICMP header and data
+  uint16 id;
+  uint16 seq;
+};
+
+#define ICMP_ECHOREPLY 0
+#define ICMP_ECHO      8
+
 // an ARP packet (comes after an Ethernet header).
 struct arp {
   uint16 hrd; // format of hardware address
@@ -125,3 +145,151 @@ struct dns_data {
   uint32 ttl;
   uint16 len;
 } __attribute__((packed));
+
+//
+// batched datagram I/O
+//
+
+// recvmmsg() receive timestamps, in udpmsg.stamp[]: when the
+// datagram reached each stage, in nanoseconds since boot (the
+// same clock as clock_ns()).
+#define RXSTAMP_NIC 0 // taken off the e1000's receive ring
+#define RXSTAMP_ENQ 1 // queued on its port
+#define RXSTAMP_DEQ 2 // taken off the port's queue by recvmmsg()
+#define NRXSTAMP    3
+
+// one datagram for recvmmsg() and sendmmsg().
+// addr and port are host byte order.
+struct udpmsg {
+  uint64 buf;   // user address of the payload buffer
+  int    len;   // recv: in size of buf, out bytes copied; send: payload length
+  uint32 addr;  // recv: source IP address; send: destination
+  uint16 port;  // recv: source UDP port; send: destination
+  short  err;   // send: 0 if queued, -1 if not
+  uint64 stamp[NRXSTAMP]; // recv: see RXSTAMP_*
+};
+
+// recvmmsg() flags.
+#define MSG_DONTWAIT 0x1 // return what's queued now, even if fewer than min
+
+// sockopt(fd, opt, val) options.
+#define SO_RCVTIMEO 1 // read() waits at most val ms (0: no limit), then fails
+#define SO_NONBLOCK 2 // if val, read() fails at once when nothing's queued
+
+//
+// network statistics, read from the netstat device: a
+// struct netstat, followed by a struct netstat_port for each
+// of the first nports bound ports that fit in the read.
+// counters are since boot; tx_hiwat and itr_level aren't counts.
+//
+struct netstat {
+  // e1000
+  uint64 intr;          // interrupts
+  uint64 rx_frames;     // frames taken off the receive ring
+  uint64 rx_nobuf;      // dropped: no packet buffer to refill the ring with
+  uint64 tx_frames;     // frames queued on the transmit ring
+  uint64 tx_ringfull;   // times a sender found the transmit ring full
+  uint64 tx_hiwat;      // most transmit descriptors in flight at once
+  uint64 itr_level;     // interrupt moderation level now, 0 (none) and up
+  // stack
+  uint64 pbuf_fail;     // pbuf_alloc() found the pool empty and couldn't grow it
+  uint64 rx_short;      // dropped: too short, malformed, or not for us
+  uint64 rx_proto;      // dropped: an ethertype, IP protocol or ICMP type we don't handle
+  uint64 rx_csum;       // dropped: bad IP or UDP checksum
+  uint64 rx_noport;     // dropped: destination port not bound
+  uint64 rx_qfull;      // dropped: destination port's queue full
+  uint64 rx_reass;      // fragments dropped by reassembly (overlap, limits, timeout)
+  uint64 rx_delivered;  // datagrams queued on a port
+  uint64 icmp_echo;     // ICMP echo requests answered
+  uint64 arp_rx;        // ARP packets received
+  uint64 arp_unres;     // frames dropped for want of a neighbor's address
+  // the e1000's own statistics registers
+  uint64 hw_mpc;        // missed: dropped by the e1000, e.g. rx FIFO full
+  uint64 hw_rnbc;       // arrived with no free receive descriptor
+  uint64 hw_crcerrs;    // bad Ethernet CRC
+  uint64 hw_tpr;        // packets received, good or bad
+  uint64 hw_gprc;       // good packets received
+  uint64 hw_gorc;       // good octets received
+  uint64 hw_tpt;        // packets sent
+  uint64 hw_gptc;       // good packets sent
+  uint64 hw_gotc;       // good octets sent
+  // packet capture
+  uint64 cap_drops;     // frames not captured because the ring was full
+  int nports;           // bound ports
+  int pad;
+};
+
+struct netstat_port {
+  uint16 port;
+  short depth;          // datagrams queued now
+  short hiwat;          // most ever queued at once
+  short pad;
+  uint64 rx;            // datagrams queued
+  uint64 drops;         // dropped because the queue was full
+};
+
+// receive latency, by stage, read from the rxlat device:
+// log2 histograms of how long datagrams took over each stage
+// on the way from the e1000 to user space. count[s][i] is the
+// number that took from 2^i to 2^(i+1) nanoseconds over stage
+// s (bucket 0 from 0); the last bucket also holds anything
+// longer.
+#define RXLAT_INTR  0 // rx interrupt to the poller taking the first frame
+#define RXLAT_STACK 1 // off the ring to queued on a port
+#define RXLAT_QUEUE 2 // queued to taken off the queue, the receiver busy
+#define RXLAT_WAKE  3 // queued to taken off the queue, the receiver asleep in recv
+#define RXLAT_COPY  4 // taken off the queue to copied out to user space
+#define NRXLAT      5
+#define NLATBUCKET  32
+
+struct rxlat {
+  uint64 count[NRXLAT][NLATBUCKET];
+  uint64 sum[NRXLAT];   // nanoseconds, for the mean
+};
+
+// packet capture (capture.c): writing a struct capctl to the
+// capture device starts or stops capturing, and reading it
+// takes captured frames off the capture ring, each as a
+// struct caprec followed by caplen bytes of the frame, as many
+// whole ones as fit (0 bytes if there are none).
+struct capctl {
+  int on;        // 1 to capture, 0 to stop
+  int snaplen;   // bytes kept of each frame; 0 for as many as fit
+  int port;      // only UDP datagrams to or from this port; 0 for all frames
+};
+
+#define CAP_RX 0 // received, as handed to net_rx()
+#define CAP_TX 1 // queued on the e1000's transmit ring
+
+struct caprec {
+  uint64 ns;     // when, on the clock_ns() clock
+  uint16 caplen; // bytes of the frame that follow
+  uint16 len;    // length of the whole frame
+  uint8  dir;    // CAP_RX or CAP_TX
+  uint8  pad[3];
+};
+
+// net_rx() checksum flags, from the e1000's receive checksum offload.
+#define NET_RX_IP_OK   0x1 // IP header checksum verified
+#define NET_RX_IP_BAD  0x2 // IP header checksum wrong
+#define NET_RX_UDP_OK  0x4 // UDP checksum verified
+#define NET_RX_UDP_BAD 0x8 // UDP checksum wrong
+
+// e1000_transmit() and e1000_transmitv() flags.
+#define E1000_TX_WAIT 0x1 // wait for room in the ring
+#define E1000_TX_CSUM 0x2 // e1000 inserts IP and UDP checksums
+
+// a received IP fragment, as held by reassembly (ipfrag.c):
+// written over the Ethernet and IP headers at the start of the
+// fragment's packet buffer, which are no longer needed, and
+// linking the fragments of a datagram in order.
+struct ipfrag {
+  char *next;   // packet buffer of the next fragment
+  char *data;   // this fragment's data, within its buffer
+  uint16 off;   // offset of data within the datagram's data
+  uint16 len;
+};
+
+// size of a packet buffer from pbuf_alloc(); matches the
+// e1000's receive buffer size, E1000_RCTL_SZ_2048.
+#define PBUFSIZE 2048
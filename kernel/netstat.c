@@ -0,0 +1,89 @@
+//
+// the netstat device: each read returns a snapshot of the
+// network counters and of each bound port's queue, as a
+// struct netstat followed by struct netstat_ports (see net.h).
+//
+// the rxlat device: each read returns a struct rxlat, the
+// receive path's per-stage latency histograms, which are
+// added to with rxlat_add().
+//
+// the counters are bumped with NETSTAT_INC() wherever the
+// stack or driver takes a packet, or drops one; they're
+// updated without a lock, so a snapshot may be a count or two
+// out between fields. the hw_ counters are the e1000's own,
+// collected by e1000_stats().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "net.h"
+
+struct netstat netstats;
+struct rxlat rxlats;
+
+static int
+netstatread(int user_dst, uint64 dst, int n)
+{
+  struct netstat *st;
+  int max, len;
+
+  if(n < 0)
+    return -1;
+  if((st = (struct netstat *)kalloc()) == 0)
+    return -1;
+
+  e1000_stats();  // bring the hardware counts up to date
+  memmove(st, &netstats, sizeof(*st));
+  st->itr_level = e1000_moderation();
+  max = (PGSIZE - sizeof(*st)) / sizeof(struct netstat_port);
+  st->nports = net_portstats((struct netstat_port *)(st + 1), max);
+  len = sizeof(*st) + (st->nports < max ? st->nports : max) * sizeof(struct netstat_port);
+
+  if(n > len)
+    n = len;
+  if(either_copyout(user_dst, dst, st, n) < 0)
+    n = -1;
+  kfree((char *)st);
+  return n;
+}
+
+// note that a datagram took from time CSR value t0 to t1 over
+// stage (an RXLAT_*).
+void
+rxlat_add(int stage, uint64 t0, uint64 t1)
+{
+  uint64 ns = t1 > t0 ? timer_ns(t1 - t0) : 0;
+  int b = 0;
+
+  while(b < NLATBUCKET - 1 && (ns >> (b + 1)) != 0)
+    b++;
+  __atomic_fetch_add(&rxlats.count[stage][b], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&rxlats.sum[stage], ns, __ATOMIC_RELAXED);
+}
+
+static int
+rxlatread(int user_dst, uint64 dst, int n)
+{
+  if(n < 0)
+    return -1;
+  if(n > sizeof(rxlats))
+    n = sizeof(rxlats);
+  if(either_copyout(user_dst, dst, &rxlats, n) < 0)
+    return -1;
+  return n;
+}
+
+void
+netstatinit(void)
+{
+  devsw[NETSTAT].read = netstatread;
+  devsw[RXLAT].read = rxlatread;
+}
@@ -0,0 +1,159 @@
+//
+// packet buffers for the e1000 driver and the network stack.
+//
+// the e1000 receives into 2048-byte buffers (E1000_RCTL_SZ_2048)
+// and no frame we send is bigger, so a whole page per packet
+// wastes half of it, and kalloc()/kfree() take the global
+// kmem.lock and fill each page with junk on every packet.
+//
+// instead, half-page buffers are carved out of kalloc()ed pages
+// and recycled: each CPU keeps a small cache of free buffers,
+// which is refilled from (and overflows into) a global free list
+// in batches. the pool only grows, up to PBUF_MAX buffers;
+// buffers are never given back to kalloc().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "net.h"
+
+// buffers allocated by pbufinit(), enough for the rx ring and
+// a few full port queues before the pool has to grow.
+#define PBUF_PREALLOC 256
+
+// most buffers the pool grows to (16 MB). past this, pbuf_alloc()
+// fails and the receive path drops frames, rather than a flood
+// that nobody reads using up all of memory. enough for the
+// largest rx and tx rings and plenty of queued datagrams.
+#define PBUF_MAX 8192
+
+// most free buffers a CPU keeps to itself; it moves half of
+// them to or from the global list at a time.
+#define PBUF_CACHE 32
+
+struct pbuf {
+  struct pbuf *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct pbuf *freelist;
+  int nfree;
+  int total;  // buffers ever allocated
+} pbufs;
+
+struct pbufcache {
+  struct pbuf *freelist;
+  int nfree;
+};
+
+static struct pbufcache pbufcache[NCPU];
+
+// carve a fresh page into buffers and put them on the global list.
+// returns 0 if the pool is as big as it may get, or out of memory.
+// caller must hold pbufs.lock.
+static int
+pbuf_grow(void)
+{
+  if(pbufs.total + PGSIZE / PBUFSIZE > PBUF_MAX)
+    return 0;
+  char *page = kalloc();
+  if(page == 0)
+    return 0;
+  for(char *b = page; b + PBUFSIZE <= page + PGSIZE; b += PBUFSIZE){
+    struct pbuf *pb = (struct pbuf *) b;
+    pb->next = pbufs.freelist;
+    pbufs.freelist = pb;
+    pbufs.nfree++;
+    pbufs.total++;
+  }
+  return 1;
+}
+
+void
+pbufinit(void)
+{
+  initlock(&pbufs.lock, "pbufs");
+  acquire(&pbufs.lock);
+  while(pbufs.total < PBUF_PREALLOC)
+    if(pbuf_grow() == 0)
+      panic("pbufinit");
+  release(&pbufs.lock);
+}
+
+// allocate a PBUFSIZE-byte packet buffer.
+// returns 0 if the pool is empty and can't grow, either because
+// it has reached PBUF_MAX or because kalloc() failed.
+char *
+pbuf_alloc(void)
+{
+  struct pbuf *pb;
+
+  push_off();
+  struct pbufcache *c = &pbufcache[cpuid()];
+
+  if(c->freelist == 0){
+    // take a batch from the global list.
+    acquire(&pbufs.lock);
+    if(pbufs.freelist == 0)
+      pbuf_grow();
+    while(pbufs.freelist && c->nfree < PBUF_CACHE / 2){
+      pb = pbufs.freelist;
+      pbufs.freelist = pb->next;
+      pbufs.nfree--;
+      pb->next = c->freelist;
+      c->freelist = pb;
+      c->nfree++;
+    }
+    release(&pbufs.lock);
+  }
+
+  pb = c->freelist;
+  if(pb){
+    c->freelist = pb->next;
+    c->nfree--;
+  }
+
+  pop_off();
+  if(pb == 0)
+    NETSTAT_INC(pbuf_fail);
+  return (char *) pb;
+}
+
+// return a buffer from pbuf_alloc() to the pool.
+void
+pbuf_free(char *buf)
+{
+  struct pbuf *pb = (struct pbuf *) buf;
+
+  if(((uint64)buf % PBUFSIZE) != 0 || (uint64)buf >= PHYSTOP)
+    panic("pbuf_free");
+
+  push_off();
+  struct pbufcache *c = &pbufcache[cpuid()];
+
+  pb->next = c->freelist;
+  c->freelist = pb;
+  c->nfree++;
+
+  if(c->nfree > PBUF_CACHE){
+    // give half back, so a CPU that only frees (e.g. the
+    // one running recv()) doesn't hoard the pool.
+    acquire(&pbufs.lock);
+    while(c->nfree > PBUF_CACHE / 2){
+      pb = c->freelist;
+      c->freelist = pb->next;
+      c->nfree--;
+      pb->next = pbufs.freelist;
+      pbufs.freelist = pb;
+      pbufs.nfree++;
+    }
+    release(&pbufs.lock);
+  }
+
+  pop_off();
+}
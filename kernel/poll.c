@@ -0,0 +1,247 @@
+//
+// poll(): wait for any of a set of file descriptors to be ready.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+
+void
+pollwaitinit(struct pollwait *pw)
+{
+  initlock(&pw->lock, "pollwait");
+  pw->ready = 0;
+}
+
+// add e to ph's waiters. called by a file's poll function.
+// caller must hold lk, the lock protecting ph.
+void
+pollregister(struct pollhead *ph, struct spinlock *lk, struct pollentry *e)
+{
+  e->head = ph;
+  e->lock = lk;
+  e->next = ph->first;
+  ph->first = e;
+}
+
+// remove e from the waiters it was registered with, if any.
+void
+pollunregister(struct pollentry *e)
+{
+  struct pollentry **pp;
+
+  if(e->head == 0)
+    return;
+  acquire(e->lock);
+  for(pp = &e->head->first; *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  release(e->lock);
+  e->head = 0;
+}
+
+// tell ph's waiters that events may now be ready.
+// caller must hold the lock protecting ph.
+void
+pollwake(struct pollhead *ph, int events)
+{
+  for(struct pollentry *e = ph->first; e; e = e->next){
+    if(((e->events | POLLHUP) & events) == 0)
+      continue;
+    pollready(e);
+  }
+}
+
+// wait until something has been put on pw's ready list, the
+// caller is killed, or (if it isn't 0) the time reaches deadline.
+void
+pollsleep(struct pollwait *pw, uint64 deadline)
+{
+  acquire(&pw->lock);
+  while(pw->ready == 0 && !killed(myproc())){
+    if(deadline == 0)
+      sleep(pw, &pw->lock);
+    else if(timedsleep(pw, &pw->lock, deadline))
+      break;
+  }
+  release(&pw->lock);
+}
+
+// take everything on pw's ready list. the entries stay marked
+// ready, so that pollwake() leaves their rnext links alone,
+// until the caller steps past each one with pollnext().
+struct pollentry *
+polltake(struct pollwait *pw)
+{
+  struct pollentry *list;
+
+  acquire(&pw->lock);
+  list = pw->ready;
+  pw->ready = 0;
+  release(&pw->lock);
+  return list;
+}
+
+// the entry after e on a list from polltake(). from now on e
+// can be woken again, so the caller should look at its file
+// only after this.
+struct pollentry *
+pollnext(struct pollentry *e)
+{
+  struct pollentry *next;
+
+  acquire(&e->pw->lock);
+  next = e->rnext;
+  e->ready = 0;
+  release(&e->pw->lock);
+  return next;
+}
+
+// put e (back) on its pollwait's ready list.
+void
+pollready(struct pollentry *e)
+{
+  struct pollwait *pw = e->pw;
+
+  acquire(&pw->lock);
+  if(!e->ready){
+    e->ready = 1;
+    e->rnext = pw->ready;
+    pw->ready = e;
+  }
+  wakeup(pw);
+  release(&pw->lock);
+}
+
+// take e off its pollwait's ready list, if it's there.
+void
+pollunready(struct pollentry *e)
+{
+  struct pollwait *pw = e->pw;
+  struct pollentry **pp;
+
+  acquire(&pw->lock);
+  if(e->ready){
+    for(pp = &pw->ready; *pp; pp = &(*pp)->rnext){
+      if(*pp == e){
+        *pp = e->rnext;
+        break;
+      }
+    }
+    e->ready = 0;
+  }
+  release(&pw->lock);
+}
+
+// entries for a poll() call come out of kalloc()ed pages.
+#define EPP (PGSIZE / sizeof(struct pollentry))
+
+//
+// poll(struct pollfd *fds, int nfds, int timeout)
+// wait until at least one of fds[i].fd is ready for
+// fds[i].events, or for timeout milliseconds, and set each
+// fds[i].revents to what it's ready for. with timeout 0, don't
+// wait; -1 waits for as long as it takes.
+// returns the number of fds with revents set (0 if it timed
+// out), or -1.
+//
+// the files are each checked once, leaving an entry on each of
+// their waiter lists; after that only the files whose state
+// changed are looked at again.
+//
+uint64
+sys_poll(void)
+{
+  struct proc *p = myproc();
+  uint64 addr;
+  int nfds, timeout;
+  struct pollfd *fds = 0;
+  struct pollentry *pages[(NOFILE + EPP - 1) / EPP];
+  struct pollwait pw;
+  int i, n, nready, r;
+
+  argaddr(0, &addr);
+  argint(1, &nfds);
+  argint(2, &timeout);
+  if(nfds < 0 || nfds > NOFILE || timeout < -1)
+    return -1;
+  uint64 deadline = timeout > 0 ? timer_deadline(timeout) : 0;
+
+  // NOFILE pollfds fit in a page.
+  n = (nfds + EPP - 1) / EPP;
+  memset(pages, 0, sizeof(pages));
+  r = -1;
+  if((fds = (struct pollfd *)kalloc()) == 0)
+    goto out;
+  for(i = 0; i < n; i++)
+    if((pages[i] = (struct pollentry *)kalloc()) == 0)
+      goto out;
+  if(copyin(p->pagetable, (char *)fds, addr, nfds * sizeof(struct pollfd)) < 0)
+    goto out;
+
+  pollwaitinit(&pw);
+
+  // look at each file, and leave an entry on its waiter list
+  // unless there's already something to return.
+  nready = 0;
+  for(i = 0; i < nfds; i++){
+    struct pollentry *e = &pages[i / EPP][i % EPP];
+    int fd = fds[i].fd;
+    memset(e, 0, sizeof(*e));
+    fds[i].revents = 0;
+    if(fd < 0 || fd >= NOFILE || p->ofile[fd] == 0){
+      fds[i].revents = POLLNVAL;
+      nready++;
+      continue;
+    }
+    e->f = p->ofile[fd];
+    e->idx = i;
+    e->events = fds[i].events;
+    e->pw = &pw;
+    fds[i].revents = filepoll(e->f, (nready == 0 && timeout != 0) ? e : 0) &
+      (fds[i].events | POLLHUP);
+    if(fds[i].revents)
+      nready++;
+  }
+
+  // sleep until a file's state changes, and then look at
+  // just the files that changed.
+  while(nready == 0 && timeout != 0){
+    pollsleep(&pw, deadline);
+    struct pollentry *list = polltake(&pw);
+    if(list == 0)
+      break;  // killed, or timed out
+    for(struct pollentry *e = list, *next; e; e = next){
+      next = pollnext(e);
+      i = e->idx;
+      fds[i].revents = filepoll(e->f, 0) & (e->events | POLLHUP);
+      if(fds[i].revents)
+        nready++;
+    }
+  }
+
+  for(i = 0; i < nfds; i++)
+    pollunregister(&pages[i / EPP][i % EPP]);
+
+  if(!killed(p) &&
+     copyout(p->pagetable, addr, (char *)fds, nfds * sizeof(struct pollfd)) == 0)
+    r = nready;
+
+ out:
+  for(i = 0; i < n; i++)
+    if(pages[i])
+      kfree(pages[i]);
+  if(fds)
+    kfree(fds);
+  return r;
+}
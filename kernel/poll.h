@@ -0,0 +1,26 @@
+// one file descriptor for poll().
+struct pollfd {
+  int fd;
+  short events;   // what to wait for
+  short revents;  // what happened
+};
+
+#define POLLIN   0x001  // data to read
+#define POLLOUT  0x004  // writing won't block
+#define POLLHUP  0x010  // other end closed, or port unbound; always reported
+#define POLLNVAL 0x020  // fd isn't open, or can't be polled; always reported
+
+// one ready descriptor from epoll_wait().
+struct epoll_event {
+  int fd;
+  int events;  // POLLIN &c
+};
+
+// epoll_ctl() operations.
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+// epoll_ctl() events flag: report the descriptor only when its
+// state changes, not each epoll_wait() for as long as it's ready.
+#define EPOLLET 0x100
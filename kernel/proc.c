@@ -16,6 +16,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -166,6 +167,7 @@ freeproc(struct proc *p)
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
+  p->kthread = 0;
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
@@ -202,6 +204,16 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the clock page, shared by every process, read-only
+  // for user code.
+  if(mappages(pagetable, UCLOCK, PGSIZE,
+              timer_uclock(), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -212,6 +224,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, UCLOCK, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -231,6 +244,44 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread: a process that runs fn() in the kernel,
+// on its own kernel stack, and never returns to user space.
+// Returns its pid, or -1 if there's no free proc.
+int
+kthread_create(void (*fn)(void), char *name)
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->kthread = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+
+  return pid;
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kthread();
+  panic("kthread returned");
+}
+
 // Shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -583,6 +634,18 @@ wakeup(void *chan)
   }
 }
 
+// Wake up p if it's sleeping on chan, without looking at
+// any other process.
+// Caller should hold the condition lock.
+void
+wakeproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan)
+    p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
@@ -684,4 +747,7 @@ procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+#ifdef LAB_NET
+  printf("e1000: interrupt moderation level %d\n", e1000_moderation());
+#endif
 }
@@ -60,6 +60,9 @@ timerinit()
   
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
+
+  // and user mode to read time, for clock_ns().
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
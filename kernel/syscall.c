@@ -104,12 +104,20 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_epoll_create(void);
+extern uint64 sys_epoll_ctl(void);
+extern uint64 sys_epoll_wait(void);
 
 #ifdef LAB_NET
 extern uint64 sys_bind(void);
 extern uint64 sys_unbind(void);
 extern uint64 sys_send(void);
 extern uint64 sys_recv(void);
+extern uint64 sys_recvmmsg(void);
+extern uint64 sys_sendmmsg(void);
+extern uint64 sys_socket(void);
+extern uint64 sys_sockopt(void);
 #endif
 #ifdef LAB_PGTBL
 extern uint64 sys_pgpte(void);
@@ -140,11 +148,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_poll]    sys_poll,
+[SYS_epoll_create] sys_epoll_create,
+[SYS_epoll_ctl]    sys_epoll_ctl,
+[SYS_epoll_wait]   sys_epoll_wait,
 #ifdef LAB_NET
 [SYS_bind] sys_bind,
 [SYS_unbind] sys_unbind,
 [SYS_send] sys_send,
 [SYS_recv] sys_recv,
+[SYS_recvmmsg] sys_recvmmsg,
+[SYS_sendmmsg] sys_sendmmsg,
+[SYS_socket] sys_socket,
+[SYS_sockopt] sys_sockopt,
 #endif
 #ifdef LAB_PGTBL
 [SYS_pgpte] sys_pgpte,
@@ -35,3 +35,11 @@
 #define SYS_recv      32
 #define SYS_pgpte     33
 #define SYS_kpgtbl    34
+#define SYS_recvmmsg  35
+#define SYS_sendmmsg  36
+#define SYS_socket    37
+#define SYS_poll      38
+#define SYS_epoll_create 39
+#define SYS_epoll_ctl    40
+#define SYS_epoll_wait   41
+#define SYS_sockopt      42
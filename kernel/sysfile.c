@@ -474,6 +474,65 @@ sys_exec(void)
   return -1;
 }
 
+uint64
+sys_epoll_create(void)
+{
+  struct file *f;
+  int fd;
+
+  if(epollalloc(&f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// epoll_ctl(int epfd, int op, int fd, int events)
+// EPOLL_CTL_DEL works even if fd has been closed.
+uint64
+sys_epoll_ctl(void)
+{
+  struct file *ef, *f;
+  int op, fd, events;
+
+  if(argfd(0, 0, &ef) < 0)
+    return -1;
+  argint(1, &op);
+  argint(3, &events);
+  if(argfd(2, &fd, &f) < 0){
+    // closed; epollctl() only lets it be deleted.
+    argint(2, &fd);
+    if(fd < 0 || fd >= NOFILE)
+      return -1;
+    f = 0;
+  }
+  if(ef->type != FD_EPOLL)
+    return -1;
+  return epollctl(ef->ep, op, fd, f, events);
+}
+
+// epoll_wait(int epfd, struct epoll_event *events, int max, int timeout)
+// timeout is in milliseconds; 0 doesn't wait, -1 waits until
+// something is ready.
+uint64
+sys_epoll_wait(void)
+{
+  struct file *f;
+  uint64 addr;
+  int max, timeout;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  argaddr(1, &addr);
+  argint(2, &max);
+  argint(3, &timeout);
+  if(f->type != FD_EPOLL || max < 0 || timeout < -1)
+    return -1;
+  return epollwait(f->ep, addr, max, timeout);
+}
+
 uint64
 sys_pipe(void)
 {
@@ -503,3 +562,52 @@ sys_pipe(void)
   }
   return 0;
 }
+
+#ifdef LAB_NET
+//
+// socket(int lport, int raddr, int rport)
+// return a file descriptor for UDP port lport, which mustn't
+// already be bound. read() receives a datagram sent to lport,
+// write() sends one to raddr and rport (if rport isn't 0),
+// and lport is unbound when the descriptor is closed.
+//
+uint64
+sys_socket(void)
+{
+  int lport, raddr, rport;
+  struct file *f;
+  int fd;
+
+  argint(0, &lport);
+  argint(1, &raddr);
+  argint(2, &rport);
+  if(lport < 0 || lport > 65535 || rport < 0 || rport > 65535)
+    return -1;
+  if(sockalloc(&f, lport, raddr, rport) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+//
+// sockopt(int fd, int opt, int val)
+// set option opt of socket fd to val; see net.h.
+//
+uint64
+sys_sockopt(void)
+{
+  struct file *f;
+  int opt, val;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  argint(1, &opt);
+  argint(2, &val);
+  if(f->type != FD_SOCK)
+    return -1;
+  return sockopt(f->sock, opt, val);
+}
+#endif
@@ -0,0 +1,179 @@
+//
+// timed sleeps.
+//
+// a process that sleeps with a deadline puts a timer on a list
+// sorted by deadline. each hart's timer interrupt is set for the
+// earlier of its next clock tick and the first timer, and runs
+// the timers that are due, waking just their own processes; the
+// cost of a timer interrupt doesn't depend on how many processes
+// are asleep.
+//
+// deadlines are in units of the time CSR, which qemu advances
+// at 10 MHz.
+//
+// user code reads the time CSR directly; the clock page, mapped
+// read-only at UCLOCK in every process, tells it the frequency.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define TIMER_PER_MS 10000
+
+struct timer {
+  uint64 when;
+  struct proc *p;          // to wake up
+  void *chan;              // p's sleep channel
+  struct spinlock *lk;     // p's condition lock
+  int state;               // protected by timerlock
+  int fired;               // protected by lk
+  struct timer *next;
+};
+
+enum { TIMER_PENDING, TIMER_RUNNING, TIMER_DONE };
+
+static struct spinlock timerlock;
+static struct timer *timers;  // sorted by when
+
+static struct uclock *uclock;  // the clock page
+
+void
+timerlistinit(void)
+{
+  initlock(&timerlock, "timer");
+
+  if((uclock = (struct uclock *)kalloc()) == 0)
+    panic("timerlistinit: clock page");
+  memset(uclock, 0, PGSIZE);
+  uclock->freq = TIMER_PER_MS * 1000;
+}
+
+// a time CSR value (or interval) in nanoseconds.
+uint64
+timer_ns(uint64 t)
+{
+  uint64 freq = TIMER_PER_MS * 1000;
+
+  // split, so that t * 1e9 doesn't overflow.
+  return t / freq * 1000000000 + t % freq * 1000000000 / freq;
+}
+
+// the physical address of the clock page, for proc_pagetable().
+uint64
+timer_uclock(void)
+{
+  return (uint64)uclock;
+}
+
+// the deadline ms milliseconds from now.
+uint64
+timer_deadline(int ms)
+{
+  return r_time() + (uint64)ms * TIMER_PER_MS;
+}
+
+static void
+timer_add(struct timer *t)
+{
+  struct timer **pp;
+
+  acquire(&timerlock);
+  for(pp = &timers; *pp && (*pp)->when <= t->when; pp = &(*pp)->next)
+    ;
+  t->next = *pp;
+  *pp = t;
+  t->state = TIMER_PENDING;
+
+  // other harts pick the timer up at their next interrupt, but
+  // this one may not have one due in time.
+  if(t->when < r_stimecmp())
+    w_stimecmp(t->when);
+  release(&timerlock);
+}
+
+// remove t from the list, waiting for it to finish if
+// it's already running.
+// the caller must not hold t->lk, which t's wakeup acquires.
+static void
+timer_del(struct timer *t)
+{
+  struct timer **pp;
+
+  acquire(&timerlock);
+  if(t->state == TIMER_PENDING){
+    for(pp = &timers; *pp; pp = &(*pp)->next){
+      if(*pp == t){
+        *pp = t->next;
+        break;
+      }
+    }
+    t->state = TIMER_DONE;
+  }
+  while(t->state == TIMER_RUNNING){
+    release(&timerlock);
+    acquire(&timerlock);
+  }
+  release(&timerlock);
+}
+
+// run the timers that are due at time now.
+// called from clockintr() on every hart.
+// returns when the next one is due.
+uint64
+timer_run(uint64 now)
+{
+  struct timer *t;
+  uint64 next;
+
+  acquire(&timerlock);
+  while((t = timers) != 0 && t->when <= now){
+    timers = t->next;
+    t->state = TIMER_RUNNING;
+    release(&timerlock);
+
+    acquire(t->lk);
+    t->fired = 1;
+    wakeproc(t->p, t->chan);
+    release(t->lk);
+
+    acquire(&timerlock);
+    t->state = TIMER_DONE;
+  }
+  next = timers ? timers->when : ~0ULL;
+  release(&timerlock);
+  return next;
+}
+
+// like sleep(chan, lk), but also return once the time reaches
+// deadline. returns 1 if it did, 0 if woken up before then.
+int
+timedsleep(void *chan, struct spinlock *lk, uint64 deadline)
+{
+  struct timer t;
+
+  if(r_time() >= deadline)
+    return 1;
+
+  t.when = deadline;
+  t.p = myproc();
+  t.chan = chan;
+  t.lk = lk;
+  t.fired = 0;
+  timer_add(&t);
+
+  // the timer sets fired while holding lk, so it can't
+  // go off between this check and going to sleep.
+  if(!t.fired)
+    sleep(chan, lk);
+
+  release(lk);
+  timer_del(&t);
+  acquire(lk);
+
+  return t.fired;
+}
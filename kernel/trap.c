@@ -165,17 +165,32 @@ kerneltrap()
 void
 clockintr()
 {
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+
+  // the interrupt may be early, for a timed sleep,
+  // rather than for the next tick.
+  if(now >= c->nexttick){
+    if(cpuid() == 0){
+      acquire(&tickslock);
+      ticks++;
+      wakeup(&ticks);
+      release(&tickslock);
+#ifdef LAB_NET
+      e1000_tick();
+      arp_tick();
+      ipfrag_tick();
+#endif
+    }
+    // 1000000 is about a tenth of a second.
+    c->nexttick = now + 1000000;
   }
 
+  uint64 next = timer_run(now);
+
   // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // the interrupt request.
+  w_stimecmp(next < c->nexttick ? next : c->nexttick);
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -145,7 +145,8 @@ elif sys.argv[1] == "ping":
     sock.bind(("127.0.0.1", SERVERPORT))
     print("ping: listening for UDP packets")
     while True:
-        buf, raddr = sock.recvfrom(4096)
+        # big enough for nettest frag's fragmented datagrams.
+        buf, raddr = sock.recvfrom(65536)
         sock.sendto(buf, raddr)
 elif sys.argv[1] == "grade":
     sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
@@ -24,7 +24,7 @@ SERVERPORT = (os.getuid() % 5000) + 25099
 
 
 def usage():
-    sys.stderr.write("Usage: stress_test.py [rate]\n")
+    sys.stderr.write("Usage: stress_test.py [rate | ringsweep [rate]]\n")
     sys.stderr.write("\n")
     sys.stderr.write("Finds maximum sustainable throughput for xv6 networking.\n")
     sys.stderr.write("\n")
@@ -32,8 +32,10 @@ def usage():
     sys.stderr.write("  stress_test.py          - Auto-find max rate (binary search)\n")
     sys.stderr.write("  stress_test.py 5000     - Test at 5000 packets/sec\n")
     sys.stderr.write("  stress_test.py 10000    - Test at 10000 packets/sec\n")
+    sys.stderr.write("  stress_test.py ringsweep - Loss rate for each e1000 ring size\n")
     sys.stderr.write("\n")
     sys.stderr.write("Make sure xv6 is running 'nettest throughput' first!\n")
+    sys.stderr.write("Also run 'netstat serve &' in xv6 to see where packets are lost.\n")
     sys.exit(1)
 
 
@@ -123,6 +125,72 @@ def test_queuedepth():
     print("3. Plot the data to see queue behavior under load")
 
 
+def query_netstat():
+    """
+    Ask xv6's 'netstat serve' (port 2001, via FWDPORT2) for its
+    counters. Returns a dict, or None if it isn't running.
+    """
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(0.5)
+    try:
+        sock.sendto(b"netstat", ("127.0.0.1", FWDPORT2))
+        data, _ = sock.recvfrom(4096)
+    except socket.timeout:
+        return None
+    finally:
+        sock.close()
+    stats = {}
+    for field in data.decode("ascii", "replace").split():
+        name, _, value = field.partition("=")
+        if value.isdigit():
+            stats[name] = int(value)
+    return stats
+
+
+# netstat fields that are levels rather than counts; a delta
+# keeps the later value.
+NETSTAT_LEVELS = ("tx_hiwat", "itr_level")
+
+
+def netstat_delta(before, after):
+    """Counter changes between two query_netstat() snapshots."""
+    if before is None or after is None:
+        return None
+    return {k: after[k] if k in NETSTAT_LEVELS else after[k] - before.get(k, 0)
+            for k in after}
+
+
+def print_loss_attribution(delta, sent):
+    """Say where in xv6 the packets of a run were lost."""
+    print("Where packets were lost (xv6 netstat):")
+    # the netstat queries themselves are a frame each way.
+    print("  at the e1000:")
+    nic = [
+        ("never reached the e1000", sent + 1 - delta.get("hw_tpr", 0)),
+        ("missed (rx FIFO full)", delta.get("hw_mpc", 0)),
+        ("bad CRC", delta.get("hw_crcerrs", 0)),
+        ("received, not taken off ring", delta.get("hw_gprc", 0) - delta.get("rx_frames", 0)),
+    ]
+    for name, count in nic:
+        print(f"    {name:30s} {count}")
+    print(f"    {'no rx descriptor (events)':30s} {delta.get('hw_rnbc', 0)}")
+    print("  in the stack:")
+    stages = [
+        ("no buffer to refill rx ring", delta.get("rx_nobuf", 0)),
+        ("malformed or not for us", delta.get("rx_short", 0)),
+        ("protocol not handled", delta.get("rx_proto", 0)),
+        ("bad checksum", delta.get("rx_csum", 0)),
+        ("port not bound", delta.get("rx_noport", 0)),
+        ("port queue full", delta.get("rx_qfull", 0)),
+        ("reassembly", delta.get("rx_reass", 0)),
+    ]
+    for name, count in stages:
+        print(f"    {name:30s} {count}")
+    print(f"    {'tx ring full (events)':30s} {delta.get('tx_ringfull', 0)}")
+    print(f"  interrupt moderation level at the end: {delta.get('itr_level', '?')}")
+    print()
+
+
 def test_throughput(target_rate=1000):
     """
     Send 1000 packets to xv6 for throughput measurement at a specific rate
@@ -144,6 +212,9 @@ def test_throughput(target_rate=1000):
     packets_sent = 1000
     packets_received = 0
 
+    # only if xv6 is also running 'netstat serve'.
+    netstat_before = query_netstat()
+
     if target_rate <= 0:
         print(f"Sending packets at maximum speed (no rate limit)...")
         send_interval = 0
@@ -241,6 +312,10 @@ def test_throughput(target_rate=1000):
     print(f"  Effective throughput: {effective_throughput:.1f} packets/sec")
     print()
 
+    delta = netstat_delta(netstat_before, query_netstat())
+    if delta is not None:
+        print_loss_attribution(delta, packets_sent)
+
     # Relaxed validation for max speed - allow minor errors
     # 99% delivery with unique sequences is acceptable
     success = (
@@ -274,6 +349,7 @@ def test_throughput(target_rate=1000):
         "loss_rate": loss_rate,
         "throughput": effective_throughput,
         "success": success,
+        "netstat": delta,
     }
 
 
@@ -411,6 +487,71 @@ def test_findmax():
     save_results_json(results, best_rate, best_throughput)
 
 
+RING_SIZES = [16, 64, 256, 1024, 4096]
+
+
+def test_ringsweep(rate=0):
+    """
+    Measure the loss rate for each e1000 descriptor ring size.
+    The ring sizes are fixed when the kernel is built, so xv6 has
+    to be rebuilt and restarted for each one.
+    """
+    print("=" * 70)
+    print("  XV6 NETWORK THROUGHPUT - RING SIZE SWEEP")
+    print("=" * 70)
+    print()
+    if rate > 0:
+        print(f"Each ring size is tested at {rate} packets/sec.")
+    else:
+        print("Each ring size is tested with a burst at maximum speed.")
+    print()
+
+    results = []
+    for size in RING_SIZES:
+        print(f"\n{'=' * 60}")
+        print(f"Ring size {size}. In another terminal, run:")
+        print(f"  make E1000_TXRING={size} E1000_RXRING={size} qemu")
+        print("and then 'nettest throughput' in the xv6 shell.")
+        print(f"{'=' * 60}")
+        try:
+            input("Press Enter when ready (Ctrl-D to stop the sweep)...")
+        except EOFError:
+            print()
+            break
+
+        result = test_throughput(rate)
+        result["ring_size"] = size
+        results.append(result)
+
+    if not results:
+        return
+
+    print("\n" + "=" * 60)
+    print("RING SIZE SWEEP RESULTS")
+    print("=" * 60)
+    print(f"{'Ring size':<12} {'Received':<12} {'Loss %':<10} {'Throughput (pkt/s)'}")
+    print("-" * 60)
+    for r in results:
+        print(
+            f"{r['ring_size']:<12} {r['received']}/{r['sent']:<8} {r['loss_rate']:<10.1f} {r['throughput']:.1f}"
+        )
+    print("=" * 60)
+
+    filename = get_next_filename("ringsweep")
+    output = {
+        "metadata": {
+            "timestamp": datetime.now().isoformat(),
+            "test_type": "ring_size_sweep",
+            "packets_per_test": 1000,
+            "rate": rate,
+        },
+        "test_results": results,
+    }
+    with open(filename, "w") as f:
+        json.dump(output, f, indent=2)
+    print(f"\n📊 Results saved to: {filename}")
+
+
 def test_sustained():
     """
     Send packets continuously for 30 seconds at moderate rate
@@ -473,6 +614,12 @@ if __name__ == "__main__":
     if len(sys.argv) == 1:
         # No arguments - run findmax
         test_findmax()
+    elif sys.argv[1] == "ringsweep" and len(sys.argv) <= 3:
+        try:
+            rate = int(sys.argv[2]) if len(sys.argv) == 3 else 0
+        except ValueError:
+            usage()
+        test_ringsweep(rate)
     elif len(sys.argv) == 2:
         arg = sys.argv[1]
 
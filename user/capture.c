@@ -0,0 +1,145 @@
+//
+// capture frames from the kernel's capture ring into a pcap file.
+//
+//   capture file [count [snaplen [port]]]
+//
+// captures count frames (100 by default), each cut to snaplen
+// bytes (0, the default, for whole frames), and only UDP
+// datagrams to or from port if it's given. the file can be
+// copied out of fs.img and read with tcpdump -r or wireshark.
+//
+// unlike qemu's packets.pcap, which is what went over the wire,
+// this is what net_rx() was handed and what the e1000 driver was
+// asked to send. frames sent with checksum offload are captured
+// before the e1000 fills in their checksums.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/net.h"
+#include "user/user.h"
+
+// pcap file header, with nanosecond timestamps.
+struct pcap_hdr {
+  uint32 magic;
+  uint16 version_major;
+  uint16 version_minor;
+  int    thiszone;
+  uint32 sigfigs;
+  uint32 snaplen;
+  uint32 network;
+};
+
+#define PCAP_MAGIC_NS   0xa1b23c4d
+#define LINKTYPE_ETHERNET 1
+
+// pcap record header; the same size as a struct caprec, so each
+// record is converted in place.
+struct pcap_rec {
+  uint32 ts_sec;
+  uint32 ts_nsec;
+  uint32 incl_len;
+  uint32 orig_len;
+};
+
+static char buf[8192];
+
+static int
+setcapture(int fd, int on, int snaplen, int port)
+{
+  struct capctl c;
+
+  c.on = on;
+  c.snaplen = snaplen;
+  c.port = port;
+  return write(fd, &c, sizeof(c)) == sizeof(c) ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, out, n;
+  int count = 100, snaplen = 0, port = 0;
+  int got = 0, nrx = 0, ntx = 0;
+
+  if(argc < 2 || argc > 5){
+    fprintf(2, "usage: capture file [count [snaplen [port]]]\n");
+    exit(1);
+  }
+  if(argc > 2)
+    count = atoi(argv[2]);
+  if(argc > 3)
+    snaplen = atoi(argv[3]);
+  if(argc > 4)
+    port = atoi(argv[4]);
+
+  if((fd = capture_open()) < 0){
+    fprintf(2, "capture: can't open the capture device\n");
+    exit(1);
+  }
+  if((out = open(argv[1], O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+    fprintf(2, "capture: can't create %s\n", argv[1]);
+    exit(1);
+  }
+
+  struct pcap_hdr h;
+  h.magic = PCAP_MAGIC_NS;
+  h.version_major = 2;
+  h.version_minor = 4;
+  h.thiszone = 0;
+  h.sigfigs = 0;
+  h.snaplen = snaplen ? snaplen : 65535;
+  h.network = LINKTYPE_ETHERNET;
+  if(write(out, &h, sizeof(h)) != sizeof(h)){
+    fprintf(2, "capture: write to %s failed\n", argv[1]);
+    exit(1);
+  }
+
+  // throw away anything left over from an earlier capture.
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  if(setcapture(fd, 1, snaplen, port) < 0){
+    fprintf(2, "capture: can't start capturing\n");
+    exit(1);
+  }
+
+  while(got < count){
+    if((n = read(fd, buf, sizeof(buf))) < 0){
+      fprintf(2, "capture: read failed\n");
+      break;
+    }
+    if(n == 0){
+      pause(1);
+      continue;
+    }
+
+    // convert the records, and keep only as many as asked for.
+    int len = 0;
+    while(len < n && got < count){
+      struct caprec *r = (struct caprec *)(buf + len);
+      struct pcap_rec *p = (struct pcap_rec *)r;
+      uint64 ns = r->ns;
+      int caplen = r->caplen, flen = r->len;
+      if(r->dir == CAP_RX)
+        nrx++;
+      else
+        ntx++;
+      p->ts_sec = ns / 1000000000;
+      p->ts_nsec = ns % 1000000000;
+      p->incl_len = caplen;
+      p->orig_len = flen;
+      len += sizeof(*p) + caplen;
+      got++;
+    }
+    if(write(out, buf, len) != len){
+      fprintf(2, "capture: write to %s failed\n", argv[1]);
+      break;
+    }
+  }
+
+  setcapture(fd, 0, 0, 0);
+  close(out);
+  printf("capture: %d frames (%d received, %d sent) in %s\n", got, nrx, ntx, argv[1]);
+  exit(0);
+}
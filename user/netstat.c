@@ -0,0 +1,213 @@
+//
+// print the network statistics from the netstat device.
+//
+//   netstat                   counters since boot, and bound ports
+//   netstat secs [count]      per-second rates every secs seconds
+//   netstat lat               receive latency histograms, by stage
+//   netstat serve             answer each datagram to port 2001 with
+//                             the counters, as "name=value ..." text
+//
+// serve is for tests/stress_test.py, which asks for the counters
+// before and after a run (host port FWDPORT2 reaches 2001).
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/net.h"
+#include "user/user.h"
+
+#define SERVEPORT 2001
+
+static char buf[4096];
+
+// read a snapshot into buf. returns the number of ports in it.
+static int
+snapshot(int fd)
+{
+  int n = read(fd, buf, sizeof(buf));
+  if(n < (int)sizeof(struct netstat)){
+    fprintf(2, "netstat: read failed\n");
+    exit(1);
+  }
+  return (n - sizeof(struct netstat)) / sizeof(struct netstat_port);
+}
+
+static void
+totals(int fd)
+{
+  struct netstat *st = (struct netstat *)buf;
+  struct netstat_port *ps = (struct netstat_port *)(st + 1);
+  int np = snapshot(fd);
+  uint64 *c = (uint64 *)st;
+
+  for(int i = 0; netstat_name(i); i++)
+    printf("%s %lu\n", netstat_name(i), c[i]);
+
+  printf("%d ports bound\n", st->nports);
+  if(np > 0)
+    printf("port\tdepth\thiwat\trx\tdrops\n");
+  for(int i = 0; i < np; i++)
+    printf("%d\t%d\t%d\t%lu\t%lu\n", ps[i].port, ps[i].depth, ps[i].hiwat,
+           ps[i].rx, ps[i].drops);
+  if(np < st->nports)
+    printf("(%d more)\n", st->nports - np);
+}
+
+static void
+rates(int fd, int secs, int count)
+{
+  struct netstat prev, cur, d;
+  uint64 *c = (uint64 *)&d;
+
+  if(netstat_read(fd, &prev) < 0){
+    fprintf(2, "netstat: read failed\n");
+    exit(1);
+  }
+  for(int n = 0; count == 0 || n < count; n++){
+    pause(secs * 10);
+    if(netstat_read(fd, &cur) < 0){
+      fprintf(2, "netstat: read failed\n");
+      exit(1);
+    }
+    netstat_delta(&d, &prev, &cur);
+    for(int i = 0; netstat_name(i); i++){
+      if(strcmp(netstat_name(i), "tx_hiwat") == 0 ||
+         strcmp(netstat_name(i), "itr_level") == 0)
+        printf("%s %lu", netstat_name(i), c[i]);  // not a count
+      else
+        printf("%s %lu/s", netstat_name(i), c[i] / secs);
+      printf(netstat_name(i + 1) ? " " : "\n");
+    }
+    prev = cur;
+  }
+}
+
+static char *stages[NRXLAT] = {
+  [RXLAT_INTR]  "interrupt to poller",
+  [RXLAT_STACK] "ring to port queue",
+  [RXLAT_QUEUE] "queued, receiver busy",
+  [RXLAT_WAKE]  "queued, receiver asleep",
+  [RXLAT_COPY]  "dequeue to user copy",
+};
+
+// print ns nanoseconds with a sensible unit.
+static void
+printns(uint64 ns)
+{
+  if(ns < 10000)
+    printf("%luns", ns);
+  else if(ns < 10000000)
+    printf("%luus", ns / 1000);
+  else
+    printf("%lums", ns / 1000000);
+}
+
+static void
+latency(void)
+{
+  static struct rxlat lat;
+  int fd = rxlat_open();
+
+  if(fd < 0 || read(fd, &lat, sizeof(lat)) != sizeof(lat)){
+    fprintf(2, "netstat: can't read the rxlat device\n");
+    exit(1);
+  }
+  close(fd);
+
+  for(int s = 0; s < NRXLAT; s++){
+    uint64 n = 0;
+    for(int b = 0; b < NLATBUCKET; b++)
+      n += lat.count[s][b];
+    printf("%s: %lu", stages[s], n);
+    if(n > 0){
+      printf(", mean ");
+      printns(lat.sum[s] / n);
+    }
+    printf("\n");
+    for(int b = 0; b < NLATBUCKET; b++){
+      if(lat.count[s][b] == 0)
+        continue;
+      printf("  ");
+      printns(b == 0 ? 0 : 1UL << b);
+      printf("\t%lu\n", lat.count[s][b]);
+    }
+  }
+}
+
+// append the decimal x to p, returning the new end.
+static char *
+putu(char *p, uint64 x)
+{
+  char tmp[24];
+  int n = 0;
+
+  do {
+    tmp[n++] = '0' + x % 10;
+    x /= 10;
+  } while(x);
+  while(n > 0)
+    *p++ = tmp[--n];
+  return p;
+}
+
+static void
+serve(int fd)
+{
+  static char out[1024];
+  char in[64];
+  uint32 src;
+  uint16 sport;
+
+  if(bind(SERVEPORT) < 0){
+    fprintf(2, "netstat: can't bind port %d\n", SERVEPORT);
+    exit(1);
+  }
+  printf("netstat: serving on port %d\n", SERVEPORT);
+
+  for(;;){
+    if(recv(SERVEPORT, &src, &sport, in, sizeof(in)) < 0)
+      exit(1);
+
+    struct netstat *st = (struct netstat *)buf;
+    uint64 *c = (uint64 *)st;
+    snapshot(fd);
+
+    char *p = out;
+    for(int i = 0; netstat_name(i); i++){
+      int len = strlen(netstat_name(i));
+      memmove(p, netstat_name(i), len);
+      p += len;
+      *p++ = '=';
+      p = putu(p, c[i]);
+      *p++ = ' ';
+    }
+    memmove(p, "nports=", 7);
+    p = putu(p + 7, st->nports);
+    send(SERVEPORT, src, sport, out, p - out);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd;
+
+  if((fd = netstat_open()) < 0){
+    fprintf(2, "netstat: can't open the netstat device\n");
+    exit(1);
+  }
+
+  if(argc == 1){
+    totals(fd);
+  } else if(argc == 2 && strcmp(argv[1], "serve") == 0){
+    serve(fd);
+  } else if(argc == 2 && strcmp(argv[1], "lat") == 0){
+    latency();
+  } else if(argc <= 3 && atoi(argv[1]) > 0){
+    rates(fd, atoi(argv[1]), argc == 3 ? atoi(argv[2]) : 0);
+  } else {
+    fprintf(2, "usage: netstat [secs [count] | serve | lat]\n");
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,104 @@
+//
+// reading the netstat device: snapshots of the network
+// counters (struct netstat, in kernel/net.h), and the
+// difference between two of them; and opening the rxlat
+// device, for the receive latency histograms (struct rxlat),
+// and the capture device.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+#include "kernel/fcntl.h"
+#include "kernel/net.h"
+#include "user/user.h"
+
+// the uint64 counters at the start of struct netstat, in order.
+static char *names[] = {
+  "intr", "rx_frames", "rx_nobuf", "tx_frames", "tx_ringfull", "tx_hiwat",
+  "itr_level", "pbuf_fail", "rx_short", "rx_proto", "rx_csum", "rx_noport",
+  "rx_qfull", "rx_reass", "rx_delivered", "icmp_echo", "arp_rx", "arp_unres",
+  "hw_mpc", "hw_rnbc", "hw_crcerrs", "hw_tpr", "hw_gprc", "hw_gorc",
+  "hw_tpt", "hw_gptc", "hw_gotc", "cap_drops",
+};
+#define NCOUNTER (sizeof(names) / sizeof(names[0]))
+
+// open the netstat device, making it if it isn't there.
+// returns a file descriptor, or -1.
+int
+netstat_open(void)
+{
+  int fd;
+
+  if((fd = open("netstat", O_RDONLY)) < 0){
+    mknod("netstat", NETSTAT, 0);
+    fd = open("netstat", O_RDONLY);
+  }
+  return fd;
+}
+
+// open the rxlat device, making it if it isn't there.
+// returns a file descriptor, or -1.
+int
+rxlat_open(void)
+{
+  int fd;
+
+  if((fd = open("rxlat", O_RDONLY)) < 0){
+    mknod("rxlat", RXLAT, 0);
+    fd = open("rxlat", O_RDONLY);
+  }
+  return fd;
+}
+
+// open the capture device, for reading and writing, making it
+// if it isn't there. returns a file descriptor, or -1.
+int
+capture_open(void)
+{
+  int fd;
+
+  if((fd = open("capture", O_RDWR)) < 0){
+    mknod("capture", CAPTURE, 0);
+    fd = open("capture", O_RDWR);
+  }
+  return fd;
+}
+
+// read a snapshot of the counters, without the ports.
+// returns 0, or -1.
+int
+netstat_read(int fd, struct netstat *st)
+{
+  if(read(fd, st, sizeof(*st)) != sizeof(*st))
+    return -1;
+  return 0;
+}
+
+// the name of the i'th counter, or 0 past the last one.
+char *
+netstat_name(int i)
+{
+  if(i < 0 || i >= NCOUNTER)
+    return 0;
+  return names[i];
+}
+
+// set d to what the counters did between snapshots before and
+// after. tx_hiwat, itr_level and nports aren't counts, so d
+// gets after's.
+void
+netstat_delta(struct netstat *d, struct netstat *before, struct netstat *after)
+{
+  uint64 *b = (uint64 *)before, *a = (uint64 *)after, *c = (uint64 *)d;
+
+  for(int i = 0; i < NCOUNTER; i++)
+    c[i] = a[i] - b[i];
+  d->tx_hiwat = after->tx_hiwat;
+  d->itr_level = after->itr_level;
+  d->nports = after->nports;
+  d->pad = 0;
+}
@@ -6,6 +6,10 @@ typedef long int off_t;
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct udpmsg;
+struct pollfd;
+struct epoll_event;
+struct netstat;
 
 // system calls
 int fork(void);
@@ -29,11 +33,19 @@ int getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
 int uptime(void);
+int poll(struct pollfd*, int, int);
+int epoll_create(void);
+int epoll_ctl(int, int, int, int);
+int epoll_wait(int, struct epoll_event*, int, int);
 #ifdef LAB_NET
 int bind(uint16);
 int unbind(uint16);
 int send(uint16, uint32, uint16, char *, uint32);
 int recv(uint16, uint32*, uint16*, char *, uint32);
+int recvmmsg(uint16, struct udpmsg*, int, int, int, int);
+int sendmmsg(uint16, struct udpmsg*, int);
+int socket(uint16, uint32, uint16);
+int sockopt(int, int, int);
 #endif
 #ifdef LAB_PGTBL
 int ugetpid(void);
@@ -55,10 +67,21 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
+uint64 clock_ns(void);
 #ifdef LAB_LOCK
 int statistics(void*, int);
 #endif
 
+#ifdef LAB_NET
+// netstatlib.c
+int netstat_open(void);
+int rxlat_open(void);
+int capture_open(void);
+int netstat_read(int, struct netstat*);
+char* netstat_name(int);
+void netstat_delta(struct netstat*, struct netstat*, struct netstat*);
+#endif
+
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -42,9 +42,17 @@ entry("getpid");
 entry("sbrk");
 entry("pause");
 entry("uptime");
+entry("poll");
+entry("epoll_create");
+entry("epoll_ctl");
+entry("epoll_wait");
 entry("bind");
 entry("unbind");
 entry("send");
 entry("recv");
+entry("recvmmsg");
+entry("sendmmsg");
+entry("socket");
+entry("sockopt");
 entry("pgpte");
 entry("kpgtbl");